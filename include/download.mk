@@ -42,7 +42,7 @@ define DownloadMethod/unknown
 endef
 
 define DownloadMethod/default
-	$(SCRIPT_DIR)/download.pl "$(DL_DIR)" "$(FILE)" "$(MD5SUM)" $(foreach url,$(URL),"$(url)")
+	$(SCRIPT_DIR)/download.pl $(if $(DOWNLOAD_QUEUE),--queue "$(DOWNLOAD_QUEUE)") "$(DL_DIR)" "$(FILE)" "$(MD5SUM)" $(foreach url,$(URL),"$(url)")
 endef
 
 define wrap_mirror
@@ -177,6 +177,7 @@ define Download
   )
   download: $(DL_DIR)/$(FILE)
 
+  $(call BuildProfile,$(DL_DIR)/$(FILE),download)
   $(DL_DIR)/$(FILE):
 	mkdir -p $(DL_DIR)
 	$(if $(DownloadMethod/$(call dl_method,$(URL),$(PROTO))),$(DownloadMethod/$(call dl_method,$(URL),$(PROTO))),$(DownloadMethod/unknown))
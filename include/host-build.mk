@@ -142,6 +142,7 @@ ifndef DUMP
   $(if $(if $(PKG_HOST_ONLY),,$(STAMP_PREPARED)),,$(if $(strip $(PKG_SOURCE_URL)),$(call Download,default)))
   $(if $(DUMP),,$(call HostHost/Autoclean))
 
+  $(call BuildProfile,$(HOST_STAMP_PREPARED),prepare)
   $(HOST_STAMP_PREPARED):
 	@-rm -rf $(HOST_BUILD_DIR)
 	@mkdir -p $(HOST_BUILD_DIR)
@@ -151,6 +152,7 @@ ifndef DUMP
 	touch $$@
 
   $(call Host/Exports,$(HOST_STAMP_CONFIGURED))
+  $(call BuildProfile,$(HOST_STAMP_CONFIGURED),configure)
   $(HOST_STAMP_CONFIGURED): $(HOST_STAMP_PREPARED)
 	$(foreach hook,$(Hooks/HostConfigure/Pre),$(call $(hook))$(sep))
 	$(call Host/Configure)
@@ -158,12 +160,14 @@ ifndef DUMP
 	touch $$@
 
   $(call Host/Exports,$(HOST_STAMP_BUILT))
+  $(call BuildProfile,$(HOST_STAMP_BUILT),compile)
   $(HOST_STAMP_BUILT): $(HOST_STAMP_CONFIGURED)
 		$(foreach hook,$(Hooks/HostCompile/Pre),$(call $(hook))$(sep))
 		$(call Host/Compile)
 		$(foreach hook,$(Hooks/HostCompile/Post),$(call $(hook))$(sep))
 		touch $$@
 
+  $(call BuildProfile,$(HOST_STAMP_INSTALLED),install)
   $(HOST_STAMP_INSTALLED): $(HOST_STAMP_BUILT) $(if $(FORCE_HOST_INSTALL),FORCE)
 		$(call Host/Install)
 		$(foreach hook,$(Hooks/HostInstall/Post),$(call $(hook))$(sep))
@@ -192,6 +192,7 @@ define Build/DefaultTargets
 	)
 
   $(STAMP_PREPARED) : export PATH=$$(TARGET_PATH_PKG)
+  $(call BuildProfile,$(STAMP_PREPARED),prepare)
   $(STAMP_PREPARED):
 	@-rm -rf $(PKG_BUILD_DIR)
 	@mkdir -p $(PKG_BUILD_DIR)
@@ -201,6 +202,7 @@ define Build/DefaultTargets
 	touch $$@
 
   $(call Build/Exports,$(STAMP_CONFIGURED))
+  $(call BuildProfile,$(STAMP_CONFIGURED),configure)
   $(STAMP_CONFIGURED): $(STAMP_PREPARED)
 	$(foreach hook,$(Hooks/Configure/Pre),$(call $(hook))$(sep))
 	$(Build/Configure)
@@ -209,6 +211,7 @@ define Build/DefaultTargets
 	touch $$@
 
   $(call Build/Exports,$(STAMP_BUILT))
+  $(call BuildProfile,$(STAMP_BUILT),compile)
   $(STAMP_BUILT): $(STAMP_CONFIGURED)
 	$(foreach hook,$(Hooks/Compile/Pre),$(call $(hook))$(sep))
 	$(Build/Compile)
@@ -218,6 +221,7 @@ define Build/DefaultTargets
 	touch $$@
 
   $(STAMP_INSTALLED) : export PATH=$$(TARGET_PATH_PKG)
+  $(call BuildProfile,$(STAMP_INSTALLED),install)
   $(STAMP_INSTALLED): $(STAMP_BUILT)
 	$(SUBMAKE) -j1 clean-staging
 	rm -rf $(TMP_DIR)/stage-$(PKG_NAME)
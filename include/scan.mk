@@ -29,6 +29,8 @@ endef
 define PackageDir
   $(TMP_DIR)/.$(SCAN_TARGET): $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1)
   $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1): $(SCAN_DIR)/$(2)/Makefile $(SCAN_STAMP) $(foreach DEP,$(DEPS_$(SCAN_DIR)/$(2)/Makefile) $(SCAN_DEPS),$(wildcard $(if $(filter /%,$(DEP)),$(DEP),$(SCAN_DIR)/$(2)/$(DEP))))
+	MD5SUM=$$$$({ echo "$(3)"; cat $$^; } | (md5sum || md5) 2>/dev/null | awk '{print $$$$1}'); \
+	[ -s $$@ ] && [ "$$$$MD5SUM" = "$$$$(cat $$@.md5 2>/dev/null)" ] && { touch $$@; exit 0; }; \
 	{ \
 		$$(call progress,Collecting $(SCAN_NAME) info: $(SCAN_DIR)/$(2)) \
 		echo Source-Makefile: $(SCAN_DIR)/$(2)/Makefile; \
@@ -40,7 +42,8 @@ define PackageDir
 			rm -f $$@; \
 		}; \
 		echo; \
-	} > $$@ || true
+	} > $$@ || true; \
+	[ -s $$@ ] && echo "$$$$MD5SUM" > $$@.md5 || rm -f $$@.md5
 endef
 
 $(OVERRIDELIST):
@@ -154,7 +154,12 @@ staging_dir/host/.prereq-build: include/prereq-build.mk
 printdb: FORCE
 	@$(_SINGLE)$(NO_TRACE_MAKE) -p $@ V=99 DUMP_TARGET_DB=1 2>&1
 
+DOWNLOAD_JOBS ?= 4
+
 download: .config FORCE
+	@rm -f $(TOPDIR)/tmp/.download-queue
+	@+$(SUBMAKE) tools/download toolchain/download package/download target/download DOWNLOAD_QUEUE=$(TOPDIR)/tmp/.download-queue
+	@$(TOPDIR)/scripts/download.pl --prefetch $(TOPDIR)/tmp/.download-queue $(DOWNLOAD_JOBS)
 	@+$(SUBMAKE) tools/download
 	@+$(SUBMAKE) toolchain/download
 	@+$(SUBMAKE) package/download
@@ -8,6 +8,14 @@ debug () {
 	${DEBUG:-:} "$@"
 }
 
+# record a boot step against the uptime clock, see /sbin/boottrace
+boot_trace() { # <phase> <name> <start|end>
+	local up rest
+	[ -f /tmp/boottrace ] || return 0
+	read up rest < /proc/uptime
+	echo "$up $1 $2 $3" >> /tmp/boottrace
+}
+
 # newline
 N="
 "
@@ -50,40 +58,77 @@ package() {
 	return 0
 }
 
+# config variables are plain shell variables unless NO_EXPORT is unset
+config_var() { # <name> <value>
+	if [ -n "$NO_EXPORT" ]; then
+		eval "$1=\$2"
+	else
+		export "$1=$2"
+	fi
+}
+
 config () {
 	local cfgtype="$1"
 	local name="$2"
 
-	export ${NO_EXPORT:+-n} CONFIG_NUM_SECTIONS=$(($CONFIG_NUM_SECTIONS + 1))
+	config_list_join
+	config_var CONFIG_NUM_SECTIONS $(($CONFIG_NUM_SECTIONS + 1))
 	name="${name:-cfg$CONFIG_NUM_SECTIONS}"
 	append CONFIG_SECTIONS "$name"
 	[ -n "$NO_CALLBACK" ] || config_cb "$cfgtype" "$name"
-	export ${NO_EXPORT:+-n} CONFIG_SECTION="$name"
-	export ${NO_EXPORT:+-n} "CONFIG_${CONFIG_SECTION}_TYPE=$cfgtype"
+	config_var CONFIG_SECTION "$name"
+	config_var "CONFIG_${CONFIG_SECTION}_TYPE" "$cfgtype"
 }
 
 option () {
 	local varname="$1"; shift
 	local value="$*"
 
-	export ${NO_EXPORT:+-n} "CONFIG_${CONFIG_SECTION}_${varname}=$value"
+	if [ -n "$NO_EXPORT" ]; then
+		eval "CONFIG_${CONFIG_SECTION}_${varname}=\$value"
+	else
+		export "CONFIG_${CONFIG_SECTION}_${varname}=$value"
+	fi
 	[ -n "$NO_CALLBACK" ] || option_cb "$varname" "$*"
 }
 
+# A list item only sets <option>_ITEM<n> and <option>_LENGTH. The joined
+# <option> value is built once the section is complete, so adding an item
+# does not copy the items before it.
 list() {
 	local varname="$1"; shift
 	local value="$*"
 	local len
 
-	config_get len "$CONFIG_SECTION" "${varname}_LENGTH" 0
-	[ $len = 0 ] && append CONFIG_LIST_STATE "${CONFIG_SECTION}_${varname}"
-	len=$(($len + 1))
-	config_set "$CONFIG_SECTION" "${varname}_ITEM$len" "$value"
-	config_set "$CONFIG_SECTION" "${varname}_LENGTH" "$len"
-	append "CONFIG_${CONFIG_SECTION}_${varname}" "$value" "$LIST_SEP"
+	eval "len=\$((\${CONFIG_${CONFIG_SECTION}_${varname}_LENGTH:-0} + 1))"
+	[ $len = 1 ] && append CONFIG_LIST_STATE "${CONFIG_SECTION}_${varname}"
+	case " $CONFIG_LIST_PENDING " in
+		*" ${CONFIG_SECTION}_${varname} "*) ;;
+		*) CONFIG_LIST_PENDING="$CONFIG_LIST_PENDING ${CONFIG_SECTION}_${varname}";;
+	esac
+	option "${varname}_ITEM$len" "$value"
+	option "${varname}_LENGTH" "$len"
 	list_cb "$varname" "$*"
 }
 
+# set the <option> value of the lists changed since the last call
+config_list_join() {
+	local list len val item c
+
+	for list in $CONFIG_LIST_PENDING; do
+		eval "len=\${CONFIG_${list}_LENGTH:-0}"
+		val=
+		c=1
+		while [ $c -le $len ]; do
+			eval "item=\${CONFIG_${list}_ITEM$c}"
+			val="${val:+$val${item:+$LIST_SEP}}$item"
+			c=$(($c + 1))
+		done
+		config_var "CONFIG_${list}" "$val"
+	done
+	unset CONFIG_LIST_PENDING
+}
+
 config_unset() {
 	config_set "$1" "$2" ""
 }
@@ -129,7 +174,7 @@ config_foreach() {
 
 	[ -z "$CONFIG_SECTIONS" ] && return 0
 	for section in ${CONFIG_SECTIONS}; do
-		config_get cfgtype "$section" TYPE
+		eval export ${NO_EXPORT:+-n} -- "cfgtype=\${CONFIG_${section}_TYPE}"
 		[ -n "$___type" -a "x$cfgtype" != "x$___type" ] && continue
 		eval "$___function \"\$section\" \"\$@\""
 	done
@@ -144,10 +189,10 @@ config_list_foreach() {
 	local len
 	local c=1
 
-	config_get len "${section}" "${option}_LENGTH"
+	eval export ${NO_EXPORT:+-n} -- "len=\${CONFIG_${section}_${option}_LENGTH}"
 	[ -z "$len" ] && return 0
 	while [ $c -le "$len" ]; do
-		config_get val "${section}" "${option}_ITEM$c"
+		eval export ${NO_EXPORT:+-n} -- "val=\${CONFIG_${section}_${option}_ITEM$c}"
 		eval "$function \"\$val\" \"\$@\""
 		c="$(($c + 1))"
 	done
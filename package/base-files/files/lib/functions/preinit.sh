@@ -59,7 +59,9 @@ boot_run_hook() {
 		local ran; eval "ran=\$PI_RAN_$func"
 		[ -n "$ran" ] || {
 			export -n "PI_RAN_$func=1"
+			boot_trace preinit $func start
 			$func "$1" "$2"
+			boot_trace preinit $func end
 		}
 	done
 }
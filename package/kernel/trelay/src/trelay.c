@@ -19,33 +19,226 @@
 #include <linux/netdevice.h>
 #include <linux/rtnetlink.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/interrupt.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/version.h>
+
+#define TRELAY_MAX_PORTS	8
 
 static LIST_HEAD(trelay_devs);
 static struct dentry *debugfs_dir;
 
+struct trelay_stats {
+	u64 rx_packets;
+	u64 rx_bytes;
+	u64 tx_packets;
+	u64 tx_bytes;
+	u64 tx_dropped;
+	struct u64_stats_sync syncp;
+};
+
+struct trelay_port {
+	struct trelay *tr;
+	struct net_device *dev;
+	struct trelay_stats __percpu *stats;
+};
+
 struct trelay {
 	struct list_head list;
-	struct net_device *dev1, *dev2;
 	struct dentry *debugfs;
+	u32 batch;
+	int n_ports;
+	struct trelay_port ports[TRELAY_MAX_PORTS];
 	char name[];
 };
 
+/*
+ * In batch mode, frames received during one round of NAPI polls are queued
+ * per CPU and relayed from a tasklet, which runs right after the NET_RX
+ * softirq has finished polling.
+ */
+struct trelay_queue {
+	struct sk_buff_head skbs;
+	struct tasklet_struct tasklet;
+};
+
+static DEFINE_PER_CPU(struct trelay_queue, trelay_queue);
+
+rx_handler_result_t trelay_handle_frame(struct sk_buff **pskb);
+
+static inline unsigned int trelay_segs(struct sk_buff *skb)
+{
+	/* GRO super-packets count as the frames they were merged from */
+	return skb_is_gso(skb) ? skb_shinfo(skb)->gso_segs : 1;
+}
+
+static void trelay_count_rx(struct trelay_port *port, struct sk_buff *skb)
+{
+	struct trelay_stats *st = this_cpu_ptr(port->stats);
+
+	u64_stats_update_begin(&st->syncp);
+	st->rx_packets += trelay_segs(skb);
+	st->rx_bytes += skb->len;
+	u64_stats_update_end(&st->syncp);
+}
+
+static void trelay_xmit(struct trelay_port *port, struct sk_buff *skb)
+{
+	struct trelay_stats *st = this_cpu_ptr(port->stats);
+	unsigned int segs = trelay_segs(skb);
+	unsigned int len = skb->len;
+	int ret;
+
+	skb->dev = port->dev;
+	ret = dev_queue_xmit(skb);
+
+	u64_stats_update_begin(&st->syncp);
+	if (net_xmit_eval(ret) == 0) {
+		st->tx_packets += segs;
+		st->tx_bytes += len;
+	} else {
+		st->tx_dropped += segs;
+	}
+	u64_stats_update_end(&st->syncp);
+}
+
+static void trelay_forward(struct trelay_port *src, struct sk_buff *skb)
+{
+	struct trelay *tr = src->tr;
+	struct trelay_port *dst, *last = NULL;
+	struct sk_buff *clone;
+	int i;
+
+	/*
+	 * Clones share the payload (and the GSO state of super-packets), so
+	 * relaying to more than one port only costs an skb head per port.
+	 */
+	for (i = 0; i < tr->n_ports; i++) {
+		dst = &tr->ports[i];
+		if (dst == src)
+			continue;
+
+		if (last) {
+			clone = skb_clone(skb, GFP_ATOMIC);
+			if (clone)
+				trelay_xmit(last, clone);
+		}
+
+		last = dst;
+	}
+
+	if (last)
+		trelay_xmit(last, skb);
+	else
+		kfree_skb(skb);
+}
+
+static struct trelay_port *trelay_port_get_rcu(struct net_device *dev)
+{
+	if (rcu_access_pointer(dev->rx_handler) != trelay_handle_frame)
+		return NULL;
+
+	return rcu_dereference(dev->rx_handler_data);
+}
+
+static void trelay_queue_run(unsigned long data)
+{
+	struct trelay_queue *q = (struct trelay_queue *) data;
+	struct trelay_port *port;
+	struct sk_buff_head list;
+	struct sk_buff *skb;
+
+	__skb_queue_head_init(&list);
+
+	spin_lock(&q->skbs.lock);
+	skb_queue_splice_init(&q->skbs, &list);
+	spin_unlock(&q->skbs.lock);
+
+	rcu_read_lock();
+	while ((skb = __skb_dequeue(&list)) != NULL) {
+		port = trelay_port_get_rcu(skb->dev);
+		if (!port) {
+			kfree_skb(skb);
+			continue;
+		}
+
+		trelay_forward(port, skb);
+	}
+	rcu_read_unlock();
+}
+
+static void trelay_enqueue(struct trelay_port *port, struct sk_buff *skb)
+{
+	struct trelay_queue *q = this_cpu_ptr(&trelay_queue);
+	struct trelay_stats *st;
+
+	spin_lock(&q->skbs.lock);
+	if (skb_queue_len(&q->skbs) >= netdev_max_backlog) {
+		spin_unlock(&q->skbs.lock);
+
+		st = this_cpu_ptr(port->stats);
+		u64_stats_update_begin(&st->syncp);
+		st->tx_dropped += trelay_segs(skb);
+		u64_stats_update_end(&st->syncp);
+
+		kfree_skb(skb);
+		return;
+	}
+	__skb_queue_tail(&q->skbs, skb);
+	spin_unlock(&q->skbs.lock);
+
+	tasklet_schedule(&q->tasklet);
+}
+
+static void trelay_queue_purge(struct trelay *tr)
+{
+	struct trelay_queue *q;
+	struct sk_buff *skb, *tmp;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		q = per_cpu_ptr(&trelay_queue, cpu);
+
+		spin_lock_bh(&q->skbs.lock);
+		skb_queue_walk_safe(&q->skbs, skb, tmp) {
+			for (i = 0; i < tr->n_ports; i++) {
+				if (skb->dev != tr->ports[i].dev)
+					continue;
+
+				__skb_unlink(skb, &q->skbs);
+				kfree_skb(skb);
+				break;
+			}
+		}
+		spin_unlock_bh(&q->skbs.lock);
+	}
+}
+
 rx_handler_result_t trelay_handle_frame(struct sk_buff **pskb)
 {
-	struct net_device *dev;
+	struct trelay_port *port;
 	struct sk_buff *skb = *pskb;
 
-	dev = rcu_dereference(skb->dev->rx_handler_data);
-	if (!dev)
+	port = rcu_dereference(skb->dev->rx_handler_data);
+	if (!port)
 		return RX_HANDLER_PASS;
 
 	if (skb->protocol == htons(ETH_P_PAE))
 		return RX_HANDLER_PASS;
 
+	skb = skb_share_check(skb, GFP_ATOMIC);
+	if (!skb)
+		return RX_HANDLER_CONSUMED;
+
 	skb_push(skb, ETH_HLEN);
-	skb->dev = dev;
 	skb_forward_csum(skb);
-	dev_queue_xmit(skb);
+	trelay_count_rx(port, skb);
+
+	if (port->tr->batch)
+		trelay_enqueue(port, skb);
+	else
+		trelay_forward(port, skb);
 
 	return RX_HANDLER_CONSUMED;
 }
@@ -56,18 +249,53 @@ static int trelay_open(struct inode *inode, struct file *file)
 	return 0;
 }
 
+static struct trelay_stats __percpu *trelay_stats_alloc(void)
+{
+	struct trelay_stats __percpu *stats;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,13,0)
+	int cpu;
+#endif
+
+	stats = alloc_percpu(struct trelay_stats);
+	if (!stats)
+		return NULL;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,13,0)
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(stats, cpu)->syncp);
+#endif
+
+	return stats;
+}
+
+static void trelay_free(struct trelay *tr)
+{
+	int i;
+
+	for (i = 0; i < tr->n_ports; i++)
+		free_percpu(tr->ports[i].stats);
+
+	kfree(tr);
+}
+
 static int trelay_do_remove(struct trelay *tr)
 {
+	int i;
+
 	list_del(&tr->list);
 
-	dev_put(tr->dev1);
-	dev_put(tr->dev2);
+	for (i = 0; i < tr->n_ports; i++)
+		netdev_rx_handler_unregister(tr->ports[i].dev);
+
+	/* drop frames still queued for batching, wait for running tasklets */
+	trelay_queue_purge(tr);
+	synchronize_net();
 
-	netdev_rx_handler_unregister(tr->dev1);
-	netdev_rx_handler_unregister(tr->dev2);
+	for (i = 0; i < tr->n_ports; i++)
+		dev_put(tr->ports[i].dev);
 
 	debugfs_remove_recursive(tr->debugfs);
-	kfree(tr);
+	trelay_free(tr);
 
 	return 0;
 }
@@ -75,10 +303,12 @@ static int trelay_do_remove(struct trelay *tr)
 static struct trelay *trelay_find(struct net_device *dev)
 {
 	struct trelay *tr;
+	int i;
 
 	list_for_each_entry(tr, &trelay_devs, list) {
-		if (tr->dev1 == dev || tr->dev2 == dev)
-			return tr;
+		for (i = 0; i < tr->n_ports; i++)
+			if (tr->ports[i].dev == dev)
+				return tr;
 	}
 	return NULL;
 }
@@ -125,17 +355,94 @@ static const struct file_operations fops_remove = {
 	.llseek = default_llseek,
 };
 
+static void trelay_stats_get(struct trelay_port *port, struct trelay_stats *sum)
+{
+	struct trelay_stats *st;
+	unsigned int start;
+	u64 rx_packets, rx_bytes, tx_packets, tx_bytes, tx_dropped;
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(port->stats, cpu);
+
+		do {
+			start = u64_stats_fetch_begin(&st->syncp);
+			rx_packets = st->rx_packets;
+			rx_bytes = st->rx_bytes;
+			tx_packets = st->tx_packets;
+			tx_bytes = st->tx_bytes;
+			tx_dropped = st->tx_dropped;
+		} while (u64_stats_fetch_retry(&st->syncp, start));
+
+		sum->rx_packets += rx_packets;
+		sum->rx_bytes += rx_bytes;
+		sum->tx_packets += tx_packets;
+		sum->tx_bytes += tx_bytes;
+		sum->tx_dropped += tx_dropped;
+	}
+}
+
+static int trelay_stats_show(struct seq_file *m, void *v)
+{
+	struct trelay *tr = m->private;
+	struct trelay_stats sum;
+	int i;
+
+	seq_printf(m, "%-16s %12s %16s %12s %16s %12s\n", "port",
+		   "rx_packets", "rx_bytes", "tx_packets", "tx_bytes",
+		   "tx_dropped");
+
+	for (i = 0; i < tr->n_ports; i++) {
+		trelay_stats_get(&tr->ports[i], &sum);
+		seq_printf(m, "%-16s %12llu %16llu %12llu %16llu %12llu\n",
+			   tr->ports[i].dev->name,
+			   (unsigned long long) sum.rx_packets,
+			   (unsigned long long) sum.rx_bytes,
+			   (unsigned long long) sum.tx_packets,
+			   (unsigned long long) sum.tx_bytes,
+			   (unsigned long long) sum.tx_dropped);
+	}
+
+	return 0;
+}
 
-static int trelay_do_add(char *name, char *devn1, char *devn2)
+static int trelay_stats_open(struct inode *inode, struct file *file)
 {
-	struct net_device *dev1, *dev2;
+	return single_open(file, trelay_stats_show, inode->i_private);
+}
+
+static const struct file_operations fops_stats = {
+	.owner = THIS_MODULE,
+	.open = trelay_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+
+static int trelay_do_add(char *name, char **devn, int n_devs)
+{
+	struct net_device *dev;
 	struct trelay *tr, *tr1;
-	int ret;
+	int ret, i, j;
 
 	tr = kzalloc(sizeof(*tr) + strlen(name) + 1, GFP_KERNEL);
 	if (!tr)
 		return -ENOMEM;
 
+	for (i = 0; i < n_devs; i++) {
+		tr->ports[i].tr = tr;
+		tr->ports[i].stats = trelay_stats_alloc();
+		if (!tr->ports[i].stats) {
+			tr->n_ports = i;
+			trelay_free(tr);
+			return -ENOMEM;
+		}
+	}
+	tr->n_ports = n_devs;
+
 	rtnl_lock();
 	rcu_read_lock();
 
@@ -146,38 +453,48 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 	}
 
 	ret = -ENOENT;
-	dev1 = dev_get_by_name_rcu(&init_net, devn1);
-	dev2 = dev_get_by_name_rcu(&init_net, devn2);
-	if (!dev1 || !dev2)
-		goto out;
+	for (i = 0; i < n_devs; i++) {
+		dev = dev_get_by_name_rcu(&init_net, devn[i]);
+		if (!dev)
+			goto out;
 
-	ret = netdev_rx_handler_register(dev1, trelay_handle_frame, dev2);
-	if (ret < 0)
-		goto out;
+		ret = -EINVAL;
+		for (j = 0; j < i; j++)
+			if (tr->ports[j].dev == dev)
+				goto out;
 
-	ret = netdev_rx_handler_register(dev2, trelay_handle_frame, dev1);
-	if (ret < 0) {
-		netdev_rx_handler_unregister(dev1);
-		goto out;
+		tr->ports[i].dev = dev;
+		ret = -ENOENT;
 	}
 
-	dev_hold(dev1);
-	dev_hold(dev2);
+	for (i = 0; i < n_devs; i++) {
+		ret = netdev_rx_handler_register(tr->ports[i].dev,
+						 trelay_handle_frame,
+						 &tr->ports[i]);
+		if (ret < 0) {
+			while (--i >= 0)
+				netdev_rx_handler_unregister(tr->ports[i].dev);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < n_devs; i++)
+		dev_hold(tr->ports[i].dev);
 
 	strcpy(tr->name, name);
-	tr->dev1 = dev1;
-	tr->dev2 = dev2;
 	list_add_tail(&tr->list, &trelay_devs);
 
 	tr->debugfs = debugfs_create_dir(name, debugfs_dir);
 	debugfs_create_file("remove", S_IWUSR, tr->debugfs, tr, &fops_remove);
+	debugfs_create_file("stats", S_IRUSR, tr->debugfs, tr, &fops_stats);
+	debugfs_create_bool("batch", S_IRUSR | S_IWUSR, tr->debugfs, &tr->batch);
 	ret = 0;
 
 out:
 	rcu_read_unlock();
 	rtnl_unlock();
 	if (ret < 0)
-		kfree(tr);
+		trelay_free(tr);
 
 	return ret;
 }
@@ -186,8 +503,10 @@ static ssize_t trelay_add_write(struct file *file, const char __user *ubuf,
 				size_t count, loff_t *ppos)
 {
 	char buf[256];
-	char *dev1, *dev2, *tmp;
+	char *devn[TRELAY_MAX_PORTS];
+	char *cur, *tmp;
 	ssize_t len, ret;
+	int n_devs = 0;
 
 	len = min(count, sizeof(buf) - 1);
 	if (copy_from_user(buf, ubuf, len))
@@ -198,24 +517,24 @@ static ssize_t trelay_add_write(struct file *file, const char __user *ubuf,
 	if ((tmp = strchr(buf, '\n')))
 		*tmp = 0;
 
-	dev1 = strchr(buf, ',');
-	if (!dev1)
+	/* name,dev1,dev2[,dev3...] */
+	cur = strchr(buf, ',');
+	if (!cur)
 		return -EINVAL;
 
-	*(dev1++) = 0;
+	*(cur++) = 0;
 
-	dev2 = strchr(dev1, ',');
-	if (!dev2)
-		return -EINVAL;
+	while ((tmp = strsep(&cur, ",")) != NULL) {
+		if (n_devs == TRELAY_MAX_PORTS || !strlen(tmp))
+			return -EINVAL;
 
-	*(dev2++) = 0;
-	if (strchr(dev2, ','))
-		return -EINVAL;
+		devn[n_devs++] = tmp;
+	}
 
-	if (!strlen(buf) || !strlen(dev1) || !strlen(dev2))
+	if (!strlen(buf) || n_devs < 2)
 		return -EINVAL;
 
-	ret = trelay_do_add(buf, dev1, dev2);
+	ret = trelay_do_add(buf, devn, n_devs);
 	if (ret < 0)
 		return ret;
 
@@ -234,7 +553,14 @@ static struct notifier_block tr_dev_notifier = {
 
 static int __init trelay_init(void)
 {
-	int ret;
+	struct trelay_queue *q;
+	int ret, cpu;
+
+	for_each_possible_cpu(cpu) {
+		q = per_cpu_ptr(&trelay_queue, cpu);
+		skb_queue_head_init(&q->skbs);
+		tasklet_init(&q->tasklet, trelay_queue_run, (unsigned long) q);
+	}
 
 	debugfs_dir = debugfs_create_dir("trelay", NULL);
 	if (!debugfs_dir)
@@ -256,6 +582,8 @@ error:
 static void __exit trelay_exit(void)
 {
 	struct trelay *tr, *tmp;
+	struct trelay_queue *q;
+	int cpu;
 
 	unregister_netdevice_notifier(&tr_dev_notifier);
 
@@ -264,6 +592,12 @@ static void __exit trelay_exit(void)
 		trelay_do_remove(tr);
 	rtnl_unlock();
 
+	for_each_possible_cpu(cpu) {
+		q = per_cpu_ptr(&trelay_queue, cpu);
+		tasklet_kill(&q->tasklet);
+		skb_queue_purge(&q->skbs);
+	}
+
 	debugfs_remove_recursive(debugfs_dir);
 }
 
@@ -0,0 +1,87 @@
+#!/bin/sh
+# Copyright (C) 2015 OpenWrt.org
+#
+# Apply the rules of "generate.sh <args>" through a single tc batch and a
+# single iptables-restore transaction instead of one process per rule.
+#
+# Usage: apply.sh [-d] [-n] <generate.sh arguments>
+#   -d  only replay chains and devices which differ from the running setup
+#   -n  print the generated files instead of applying them
+
+QOS_STATE="${QOS_STATE:-/var/run/qos}"
+
+_dir=/usr/lib/qos
+[ -e $_dir/batch.awk ] || _dir=.
+
+diff=0
+dryrun=0
+while getopts "dn" opt; do
+	case "$opt" in
+		d) diff=1;;
+		n) dryrun=1;;
+		*) exit 1;;
+	esac
+done
+shift $(($OPTIND - 1))
+
+full=0
+[ "$1" = all ] && full=1
+
+mkdir -p "$QOS_STATE"
+rm -f "$QOS_STATE/modules.sh" "$QOS_STATE/tc.batch" "$QOS_STATE/tc.quiet" "$QOS_STATE/iptables.rules" \
+	"$QOS_STATE/applied.tc.new" "$QOS_STATE/applied.ipt.new"
+
+tc qdisc show > "$QOS_STATE/running.tc" 2>&-
+case "$1" in
+	all|firewall) iptables -t mangle -S > "$QOS_STATE/running.ipt" 2>&-;;
+	*) : > "$QOS_STATE/running.ipt";;
+esac
+
+$_dir/generate.sh "$@" | awk \
+	-v dir="$QOS_STATE" \
+	-v diff="$diff" \
+	-v full="$full" \
+	-f $_dir/batch.awk || exit 1
+
+[ "$dryrun" = 1 ] && {
+	for f in modules.sh tc.batch iptables.rules; do
+		[ -s "$QOS_STATE/$f" ] || continue
+		echo "# $f"
+		cat "$QOS_STATE/$f"
+	done
+	rm -f "$QOS_STATE/applied.tc.new" "$QOS_STATE/applied.ipt.new"
+	exit 0
+}
+
+ret=0
+[ -s "$QOS_STATE/modules.sh" ] && sh "$QOS_STATE/modules.sh"
+[ -s "$QOS_STATE/tc.batch" ] && {
+	tc -force -batch "$QOS_STATE/tc.batch" >&- 2>"$QOS_STATE/tc.err" || {
+		failed=0
+		grep -q '^Command failed' "$QOS_STATE/tc.err" || {
+			logger -t qos "Failed to apply $QOS_STATE/tc.batch: $(head -n 1 "$QOS_STATE/tc.err")"
+			failed=1
+		}
+		for n in $(sed -n 's/^Command failed .*:\([0-9]*\)$/\1/p' "$QOS_STATE/tc.err"); do
+			grep -qx "$n" "$QOS_STATE/tc.quiet" 2>&- && continue
+			logger -t qos "Failed to apply tc $(sed -n "${n}p" "$QOS_STATE/tc.batch")"
+			failed=1
+		done
+		[ "$failed" = 1 ] && {
+			rm -f "$QOS_STATE/applied.tc.new"
+			ret=1
+		}
+	}
+}
+[ -s "$QOS_STATE/iptables.rules" ] && {
+	iptables-restore --noflush < "$QOS_STATE/iptables.rules" || {
+		logger -t qos "Failed to apply $QOS_STATE/iptables.rules"
+		rm -f "$QOS_STATE/applied.ipt.new"
+		ret=1
+	}
+}
+
+[ -e "$QOS_STATE/applied.tc.new" ] && mv "$QOS_STATE/applied.tc.new" "$QOS_STATE/applied.tc"
+[ -e "$QOS_STATE/applied.ipt.new" ] && mv "$QOS_STATE/applied.ipt.new" "$QOS_STATE/applied.ipt"
+
+exit $ret
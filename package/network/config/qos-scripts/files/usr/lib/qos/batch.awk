@@ -0,0 +1,244 @@
+# Split the shell output of generate.sh into a module/ifconfig script, one
+# "tc -batch" file and one "iptables-restore --noflush" payload for the
+# mangle table. With diff=1, chains and devices whose generated rules equal
+# the last applied ones (and are still present in the running ruleset) are
+# left alone.
+#
+# Variables:
+#   dir   state directory, holds running.{tc,ipt} and applied.{tc,ipt}
+#   diff  only emit what differs from the last applied state
+#   full  the input describes all interfaces, remove qdiscs of unlisted ones
+
+function strip(s) {
+	gsub(/[ \t]*[0-9]?>&-/, "", s)
+	gsub(/[ \t]*[0-9]?>\/dev\/null/, "", s)
+	sub(/^[ \t]+/, "", s)
+	sub(/[ \t]+$/, "", s)
+	return s
+}
+
+function word(s, n,    w) {
+	split(s, w, " ")
+	return w[n]
+}
+
+function device(s) {
+	if (!match(s, /dev [^ ]+/))
+		return ""
+	return substr(s, RSTART + 4, RLENGTH - 4)
+}
+
+BEGIN {
+	ndecl = 0; nrule = 0; ndel = 0; nstale = 0; ntc = 0; ndev = 0; nsh = 0
+	nifb = 0; nifb_skip = 0
+
+	while ((getline line < (dir "/running.ipt")) > 0) {
+		if (line ~ /^-N /)
+			running_chain[word(line, 2)] = 1
+		else if (line ~ /^-A /)
+			running_rules[word(line, 2)]++
+	}
+	close(dir "/running.ipt")
+
+	while ((getline line < (dir "/running.tc")) > 0) {
+		if (line ~ /^qdisc hfsc 1: dev [^ ]+ root/)
+			running_dev[word(line, 5)] = 1
+	}
+	close(dir "/running.tc")
+
+	while ((getline line < (dir "/applied.ipt")) > 0) {
+		split(line, f, "\t")
+		applied_ipt[f[1]] = applied_ipt[f[1]] f[2] "\n"
+	}
+	close(dir "/applied.ipt")
+
+	while ((getline line < (dir "/applied.tc")) > 0) {
+		split(line, f, "\t")
+		if (!(f[1] in applied_tc))
+			applied_order[++napplied] = f[1]
+		applied_tc[f[1]] = applied_tc[f[1]] f[2] "\n"
+	}
+	close(dir "/applied.tc")
+}
+
+/^[ \t]*$/ { next }
+
+/^[ \t]*iptables -t mangle / {
+	s = strip($0)
+	sub(/^iptables -t mangle /, "", s)
+
+	# iptables-restore only understands double quotes
+	gsub(/'/, "\"", s)
+
+	op = word(s, 1)
+	chain = word(s, 2)
+
+	if (op == "-N") {
+		if (!(chain in decl))
+			decl_order[++ndecl] = chain
+		decl[chain] = 1
+	} else if (op == "-A") {
+		rule[++nrule] = s
+		rule_chain[nrule] = chain
+		chain_rules[chain] = chain_rules[chain] s "\n"
+		chain_count[chain]++
+	} else if (op == "-D") {
+		del[++ndel] = s
+	} else if (op == "-F" || op == "-X") {
+		if (!(chain in stale))
+			stale_order[++nstale] = chain
+		stale[chain] = 1
+	} else {
+		shell[++nsh] = $0
+	}
+	next
+}
+
+/^[ \t]*tc / {
+	# silenced commands are allowed to fail, e.g. deleting a missing qdisc
+	quiet = ($0 ~ /2>&-|2>\/dev\/null/)
+	s = strip($0)
+	sub(/^tc /, "", s)
+
+	dev = device(s)
+	if (!(dev in dev_cmds))
+		dev_order[++ndev] = dev
+
+	tc[++ntc] = s
+	tc_dev[ntc] = dev
+	tc_quiet[ntc] = quiet
+	dev_cmds[dev] = dev_cmds[dev] s "\n"
+	next
+}
+
+{
+	s = strip($0)
+
+	# skip modules which are already loaded, unless they are reloaded
+	if (s ~ /^(rmmod|modprobe -r) /) {
+		mod = word(s, s ~ /^rmmod/ ? 2 : 3)
+		unloaded[mod] = 1
+	} else if (s ~ /^(insmod|modprobe) /) {
+		mod = word(s, 2)
+		if (!(mod in unloaded)) {
+			shell[++nsh] = "[ -d /sys/module/" mod " ] || " $0
+			next
+		}
+	} else if (s ~ /^ifconfig /) {
+		shell_dev[nsh + 1] = word(s, 2)
+	}
+
+	# reloading ifb recreates all ifb devices
+	if (mod == "ifb")
+		shell_ifb[nsh + 1] = 1
+	mod = ""
+
+	shell[++nsh] = $0
+}
+
+END {
+	# tc: decide per device whether its commands need to be replayed
+	for (i = 1; i <= ndev; i++) {
+		dev = dev_order[i]
+		skip_dev[dev] = (diff && (dev in running_dev) && \
+			applied_tc[dev] == dev_cmds[dev])
+		if (dev ~ /^ifb/) {
+			nifb++
+			if (skip_dev[dev])
+				nifb_skip++
+		}
+	}
+	skip_ifb = (nifb > 0 && nifb == nifb_skip)
+
+	# tc.quiet lists the batch lines whose failure is expected
+	nbatch = 0
+	if (full) {
+		for (dev in running_dev) {
+			if (dev in dev_cmds)
+				continue
+			print "qdisc del dev " dev " root" > (dir "/tc.batch")
+			print "qdisc del dev " dev " ingress" > (dir "/tc.batch")
+			print ++nbatch > (dir "/tc.quiet")
+			print ++nbatch > (dir "/tc.quiet")
+		}
+	}
+
+	for (i = 1; i <= ntc; i++) {
+		if (skip_dev[tc_dev[i]])
+			continue
+		print tc[i] > (dir "/tc.batch")
+		nbatch++
+		if (tc_quiet[i])
+			print nbatch > (dir "/tc.quiet")
+	}
+
+	for (i = 1; i <= nsh; i++)
+		if (!((i in shell_dev) && skip_dev[shell_dev[i]]) && \
+		    !((i in shell_ifb) && skip_ifb))
+			print shell[i] > (dir "/modules.sh")
+
+	# iptables: a re-added jump that already exists is a no-op
+	for (i = 1; i <= nrule; i++)
+		if (!(rule_chain[i] in decl))
+			added[rule[i]] = i
+
+	for (i = 1; i <= ndel; i++) {
+		s = del[i]
+		sub(/^-D/, "-A", s)
+		if (s in added) {
+			skip_rule[added[s]] = 1
+			skip_del[i] = 1
+		}
+	}
+
+	for (i = 1; i <= ndecl; i++) {
+		chain = decl_order[i]
+		keep[chain] = (diff && (chain in running_chain) && \
+			running_rules[chain] == chain_count[chain] && \
+			applied_ipt[chain] == chain_rules[chain])
+	}
+
+	out = ""
+	for (i = 1; i <= ndecl; i++)
+		if (!keep[decl_order[i]])
+			out = out ":" decl_order[i] " - [0:0]\n"
+
+	for (i = 1; i <= ndel; i++)
+		if (!skip_del[i])
+			out = out del[i] "\n"
+
+	for (i = 1; i <= nstale; i++) {
+		chain = stale_order[i]
+		if (!(chain in decl))
+			out = out "-F " chain "\n-X " chain "\n"
+	}
+
+	for (i = 1; i <= nrule; i++)
+		if (!skip_rule[i] && !keep[rule_chain[i]])
+			out = out rule[i] "\n"
+
+	if (out != "")
+		printf "*mangle\n%sCOMMIT\n", out > (dir "/iptables.rules")
+
+	# new state, only written for the parts covered by this run
+	if (ndecl > 0 || nstale > 0) {
+		printf "" > (dir "/applied.ipt.new")
+		for (i = 1; i <= nrule; i++)
+			if (rule_chain[i] in decl)
+				print rule_chain[i] "\t" rule[i] > (dir "/applied.ipt.new")
+	}
+
+	if (ndev > 0) {
+		printf "" > (dir "/applied.tc.new")
+		for (i = 1; i <= napplied; i++) {
+			dev = applied_order[i]
+			if (full || (dev in dev_cmds))
+				continue
+			n = split(applied_tc[dev], f, "\n")
+			for (j = 1; j < n; j++)
+				print dev "\t" f[j] > (dir "/applied.tc.new")
+		}
+		for (i = 1; i <= ntc; i++)
+			print tc_dev[i] "\t" tc[i] > (dir "/applied.tc.new")
+	}
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Copyright (C) 2015 OpenWrt.org
+#
+# Compare the time it takes to apply the QoS setup by running every
+# generated command on its own against the batched apply.sh paths.
+#
+# Usage: timing.sh [<generate.sh arguments>]
+
+[ $# -gt 0 ] || set -- all
+
+uptime_ms() {
+	local s
+	read s _ < /proc/uptime
+	s="${s%.*}${s#*.}"
+	echo $(( ${s#0} * 10 ))
+}
+
+measure() {
+	local label="$1"; shift
+	local start end
+
+	start=$(uptime_ms)
+	"$@" >/dev/null 2>&1
+	end=$(uptime_ms)
+	printf "%-24s %6d ms\n" "$label" $(($end - $start))
+}
+
+sequential() {
+	/usr/lib/qos/generate.sh "$@" | sh
+}
+
+measure "generate.sh | sh" sequential "$@"
+measure "apply.sh" /usr/lib/qos/apply.sh "$@"
+measure "apply.sh -d" /usr/lib/qos/apply.sh -d "$@"
@@ -26,15 +26,22 @@
 #include <signal.h>
 #include <syslog.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
 #include <byteswap.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <net/ethernet.h>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <linux/if_packet.h>
+#include <linux/filter.h>
 
 #define ARPHRD_IEEE80211_RADIOTAP	803
 
@@ -45,16 +52,57 @@
 #define FRAMETYPE_BEACON			0x80
 #define FRAMETYPE_DATA				0x08
 
+#define FRAMECLASS_MASK				0x0C
+#define FRAMECLASS_MGMT				0x00
+#define FRAMECLASS_CTRL				0x04
+#define FRAMECLASS_DATA				0x08
+
+#define FRAMEFLAG_TODS				0x01
+#define FRAMEFLAG_FROMDS			0x02
+
+#define RADIOTAP_TSFT				0
+#define RADIOTAP_FLAGS				1
+#define RADIOTAP_EXT				31
+#define RADIOTAP_F_BADFCS			0x40
+
+#define PCAPNG_SHB					0x0A0D0D0A
+#define PCAPNG_IDB					0x00000001
+#define PCAPNG_EPB					0x00000006
+#define PCAPNG_BYTE_ORDER			0x1A2B3C4D
+#define PCAPNG_OPT_END				0
+#define PCAPNG_OPT_IF_NAME			2
+
+#define MMAP_BLOCK_SIZE				(1 << 16)	/* 64 KB per ring block */
+#define MMAP_FRAME_SIZE				(1 << 11)	/* nominal, V3 packs frames */
+#define MMAP_BLOCK_TIMEOUT			100			/* retire partial blocks after 100ms */
+
+#define PCAP_BATCH_LEN				64			/* frames per writev() call */
+
 #if __BYTE_ORDER == __BIG_ENDIAN
 #define le16(x) __bswap_16(x)
+#define le32(x) __bswap_32(x)
 #else
 #define le16(x) (x)
+#define le32(x) (x)
 #endif
 
+#define pad4(x) (((x) + 3) & ~3)
+
 uint8_t run_dump   = 0;
 uint8_t run_stop   = 0;
 uint8_t run_daemon = 0;
 
+uint8_t streaming     = 0;
+uint8_t pcapng        = 0;
+uint8_t filter_data   = 0;
+uint8_t filter_beacon = 0;
+uint8_t filter_badfcs = 0;
+uint8_t filter_class  = 0;    /* bitmask of accepted frame classes, 0 = any */
+uint8_t filter_bssid  = 0;
+uint8_t bssid[6];
+
+uint16_t pktcap = 256;		 /* truncate frames after 256 bytes */
+
 uint32_t frames_captured = 0;
 uint32_t frames_filtered = 0;
 
@@ -76,6 +124,13 @@ struct ringbuf_entry {
 	uint32_t usec;			 /* epoch microseconds */
 };
 
+struct mmap_ring {
+	uint32_t bsize;          /* block size */
+	uint32_t bnum;           /* number of blocks */
+	uint32_t cur;            /* next block to inspect */
+	uint8_t *map;            /* mapped kernel ring memory */
+};
+
 typedef struct pcap_hdr_s {
 	uint32_t magic_number;   /* magic number */
 	uint16_t version_major;  /* major version number */
@@ -100,6 +155,56 @@ typedef struct ieee80211_radiotap_header {
 	u_int32_t it_present;    /* fields present */
 } __attribute__((__packed__)) radiotap_hdr_t;
 
+typedef struct pcapng_shb_s {
+	uint32_t block_type;     /* PCAPNG_SHB */
+	uint32_t block_len;      /* total block length */
+	uint32_t byte_order;     /* byte order magic */
+	uint16_t version_major;  /* major version number */
+	uint16_t version_minor;  /* minor version number */
+	int64_t  section_len;    /* section length, -1 if unknown */
+	uint32_t block_len2;     /* total block length */
+} __attribute__((__packed__)) pcapng_shb_t;
+
+typedef struct pcapng_idb_s {
+	uint32_t block_type;     /* PCAPNG_IDB */
+	uint32_t block_len;      /* total block length */
+	uint16_t linktype;       /* data link type */
+	uint16_t reserved;
+	uint32_t snaplen;        /* max length of captured packets, in octets */
+} pcapng_idb_t;
+
+typedef struct pcapng_epb_s {
+	uint32_t block_type;     /* PCAPNG_EPB */
+	uint32_t block_len;      /* total block length */
+	uint32_t interface_id;   /* index of describing IDB */
+	uint32_t ts_high;        /* upper 32 bit of microsecond timestamp */
+	uint32_t ts_low;         /* lower 32 bit of microsecond timestamp */
+	uint32_t cap_len;        /* number of octets of packet saved in file */
+	uint32_t orig_len;       /* actual length of packet */
+} pcapng_epb_t;
+
+struct pcap_frame {
+	union {
+		pcaprec_hdr_t pcap;
+		pcapng_epb_t  epb;
+	} hdr;
+	uint8_t trailer[8];      /* pcapng padding and trailing block length */
+};
+
+struct pcap_out {
+	int fd;                  /* output descriptor */
+	uint8_t ng;              /* write pcapng instead of classic pcap */
+	int num;                 /* number of queued frames */
+	int niov;                /* number of queued vectors */
+	uint64_t size;           /* bytes written since open */
+	time_t opened;           /* monotonic time of open */
+	struct pcap_frame frm[PCAP_BATCH_LEN];
+	struct iovec iov[PCAP_BATCH_LEN * 3];
+};
+
+struct ringbuf *ring = NULL;
+struct pcap_out stream_out;
+
 
 int check_type(void)
 {
@@ -156,8 +261,65 @@ void sig_teardown(int sig)
 }
 
 
-void write_pcap_header(FILE *o)
+time_t uptime(void)
 {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec;
+}
+
+void pcap_writev(struct pcap_out *o, struct iovec *iov, int cnt)
+{
+	ssize_t len;
+
+	while (cnt > 0)
+	{
+		len = writev(o->fd, iov, cnt);
+
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		o->size += len;
+
+		/* skip fully written vectors, adjust a partially written one */
+		while (cnt > 0 && len >= iov->iov_len)
+		{
+			len -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+
+		if (cnt > 0)
+		{
+			iov->iov_base += len;
+			iov->iov_len  -= len;
+		}
+	}
+}
+
+void pcap_flush(struct pcap_out *o)
+{
+	pcap_writev(o, o->iov, o->niov);
+
+	o->num  = 0;
+	o->niov = 0;
+}
+
+void write_pcap_header(struct pcap_out *o)
+{
+	uint8_t buf[sizeof(pcapng_idb_t) + 4 + pad4(IFNAMSIZ) + 4 + 4];
+	uint32_t *trailer;
+	uint16_t *opt;
+	struct iovec iov[2];
+	int namelen = strlen(ifname);
+
 	pcap_hdr_t ghdr = {
 		.magic_number  = 0xa1b2c3d4,
 		.version_major = 2,
@@ -168,31 +330,150 @@ void write_pcap_header(FILE *o)
 		.network       = DLT_IEEE802_11_RADIO
 	};
 
-	fwrite(&ghdr, 1, sizeof(ghdr), o);
+	pcapng_shb_t shb = {
+		.block_type    = PCAPNG_SHB,
+		.block_len     = sizeof(shb),
+		.byte_order    = PCAPNG_BYTE_ORDER,
+		.version_major = 1,
+		.version_minor = 0,
+		.section_len   = -1,
+		.block_len2    = sizeof(shb)
+	};
+
+	pcapng_idb_t *idb = (pcapng_idb_t *)buf;
+
+	if (!o->ng)
+	{
+		iov[0].iov_base = &ghdr;
+		iov[0].iov_len  = sizeof(ghdr);
+
+		pcap_writev(o, iov, 1);
+		return;
+	}
+
+	/* one interface description block carrying the capture interface name */
+	memset(buf, 0, sizeof(buf));
+
+	opt = (uint16_t *)(buf + sizeof(*idb));
+	opt[0] = PCAPNG_OPT_IF_NAME;
+	opt[1] = namelen;
+	memcpy(opt + 2, ifname, namelen);
+
+	opt = (uint16_t *)((uint8_t *)opt + 4 + pad4(namelen));
+	opt[0] = PCAPNG_OPT_END;
+	opt[1] = 0;
+
+	idb->block_type = PCAPNG_IDB;
+	idb->block_len  = (uint8_t *)(opt + 2) - buf + 4;
+	idb->linktype   = DLT_IEEE802_11_RADIO;
+	idb->snaplen    = 0xFFFF;
+
+	trailer = (uint32_t *)(buf + idb->block_len - 4);
+	*trailer = idb->block_len;
+
+	iov[0].iov_base = &shb;
+	iov[0].iov_len  = sizeof(shb);
+	iov[1].iov_base = buf;
+	iov[1].iov_len  = idb->block_len;
+
+	pcap_writev(o, iov, 2);
 }
 
-void write_pcap_frame(FILE *o, uint32_t *sec, uint32_t *usec,
-					  uint16_t len, uint16_t olen)
+void write_pcap_frame(struct pcap_out *o, uint32_t sec, uint32_t usec,
+					  void *data, uint32_t len, uint32_t olen)
 {
-	struct timeval tv;
-	pcaprec_hdr_t fhdr;
+	struct pcap_frame *f = &o->frm[o->num];
+	struct iovec *iov = &o->iov[o->niov];
+	uint64_t ts;
+	uint32_t blen;
 
-	if (!sec || !usec)
+	if (!o->ng)
 	{
-		gettimeofday(&tv, NULL);
+		f->hdr.pcap.ts_sec   = sec;
+		f->hdr.pcap.ts_usec  = usec;
+		f->hdr.pcap.incl_len = len;
+		f->hdr.pcap.orig_len = olen;
+
+		iov[0].iov_base = &f->hdr.pcap;
+		iov[0].iov_len  = sizeof(f->hdr.pcap);
+		iov[1].iov_base = data;
+		iov[1].iov_len  = len;
+
+		o->niov += 2;
 	}
 	else
 	{
-		tv.tv_sec  = *sec;
-		tv.tv_usec = *usec;
+		ts   = (uint64_t)sec * 1000000 + usec;
+		blen = sizeof(f->hdr.epb) + pad4(len) + 4;
+
+		f->hdr.epb.block_type   = PCAPNG_EPB;
+		f->hdr.epb.block_len    = blen;
+		f->hdr.epb.interface_id = 0;
+		f->hdr.epb.ts_high      = ts >> 32;
+		f->hdr.epb.ts_low       = ts & 0xFFFFFFFF;
+		f->hdr.epb.cap_len      = len;
+		f->hdr.epb.orig_len     = olen;
+
+		/* zero padding followed by the trailing block length */
+		memset(f->trailer, 0, sizeof(f->trailer));
+		memcpy(f->trailer + pad4(len) - len, &blen, sizeof(blen));
+
+		iov[0].iov_base = &f->hdr.epb;
+		iov[0].iov_len  = sizeof(f->hdr.epb);
+		iov[1].iov_base = data;
+		iov[1].iov_len  = len;
+		iov[2].iov_base = f->trailer;
+		iov[2].iov_len  = pad4(len) - len + 4;
+
+		o->niov += 3;
 	}
 
-	fhdr.ts_sec   = tv.tv_sec;
-	fhdr.ts_usec  = tv.tv_usec;
-	fhdr.incl_len = len;
-	fhdr.orig_len = olen;
+	if (++o->num == PCAP_BATCH_LEN)
+		pcap_flush(o);
+}
+
+int pcap_open(struct pcap_out *o, const char *path, uint8_t ng)
+{
+	o->fd     = path ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600) : 1;
+	o->ng     = ng;
+	o->num    = 0;
+	o->niov   = 0;
+	o->size   = 0;
+	o->opened = uptime();
+
+	if (o->fd < 0)
+		return -1;
+
+	write_pcap_header(o);
+
+	return 0;
+}
+
+void pcap_close(struct pcap_out *o)
+{
+	pcap_flush(o);
+
+	if (o->fd > 2)
+		close(o->fd);
+
+	o->fd = -1;
+}
+
+/* shift path.N-2 to path.N-1 ... path to path.1 to keep N files */
+void pcap_shift(const char *path, int keep)
+{
+	char src[PATH_MAX], dst[PATH_MAX];
+
+	for (; keep > 1; keep--)
+	{
+		if (keep > 2)
+			snprintf(src, sizeof(src), "%s.%d", path, keep - 2);
+		else
+			snprintf(src, sizeof(src), "%s", path);
 
-	fwrite(&fhdr, 1, sizeof(fhdr), o);
+		snprintf(dst, sizeof(dst), "%s.%d", path, keep - 1);
+		rename(src, dst);
+	}
 }
 
 
@@ -219,20 +500,16 @@ struct ringbuf * ringbuf_init(uint32_t num_item, uint16_t len_item)
 	return NULL;
 }
 
-struct ringbuf_entry * ringbuf_add(struct ringbuf *r)
+struct ringbuf_entry * ringbuf_add(struct ringbuf *r,
+								   uint32_t sec, uint32_t usec)
 {
-	struct timeval t;
 	struct ringbuf_entry *e;
 
-	gettimeofday(&t, NULL);
-
 	e = r->buf + (r->fill++ * r->slen);
 	r->fill %= r->len;
 
-	memset(e, 0, r->slen);
-
-	e->sec = t.tv_sec;
-	e->usec = t.tv_usec;
+	e->sec = sec;
+	e->usec = usec;
 
 	return e;
 }
@@ -254,6 +531,72 @@ void ringbuf_free(struct ringbuf *r)
 }
 
 
+int mmap_ring_init(struct mmap_ring *r, uint32_t bsize, uint32_t bnum)
+{
+	int ver = TPACKET_V3;
+	struct tpacket_req3 req;
+
+	memset(&req, 0, sizeof(req));
+
+	req.tp_block_size     = bsize;
+	req.tp_block_nr       = bnum;
+	req.tp_frame_size     = MMAP_FRAME_SIZE;
+	req.tp_frame_nr       = (bsize / MMAP_FRAME_SIZE) * bnum;
+	req.tp_retire_blk_tov = MMAP_BLOCK_TIMEOUT;
+
+	if (setsockopt(capture_sock, SOL_PACKET, PACKET_VERSION,
+				   &ver, sizeof(ver)) < 0)
+		return -1;
+
+	if (setsockopt(capture_sock, SOL_PACKET, PACKET_RX_RING,
+				   &req, sizeof(req)) < 0)
+		return -1;
+
+	r->map = mmap(NULL, bsize * bnum, PROT_READ | PROT_WRITE,
+				  MAP_SHARED, capture_sock, 0);
+
+	if (r->map == MAP_FAILED)
+	{
+		r->map = NULL;
+		return -1;
+	}
+
+	r->bsize = bsize;
+	r->bnum  = bnum;
+	r->cur   = 0;
+
+	return 0;
+}
+
+struct tpacket_block_desc * mmap_ring_next(struct mmap_ring *r)
+{
+	struct tpacket_block_desc *bd = (void *)(r->map + r->cur * r->bsize);
+
+	if (!(bd->hdr.bh1.block_status & TP_STATUS_USER))
+		return NULL;
+
+	__sync_synchronize();
+
+	return bd;
+}
+
+void mmap_ring_release(struct mmap_ring *r, struct tpacket_block_desc *bd)
+{
+	__sync_synchronize();
+
+	bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	r->cur = (r->cur + 1) % r->bnum;
+}
+
+void mmap_ring_free(struct mmap_ring *r)
+{
+	if (r->map)
+		munmap(r->map, r->bsize * r->bnum);
+
+	memset(r, 0, sizeof(*r));
+}
+
+
 void msg(const char *fmt, ...)
 {
 	va_list ap;
@@ -268,40 +611,283 @@ void msg(const char *fmt, ...)
 }
 
 
-int main(int argc, char **argv)
+int attach_bpf(const char *path)
+{
+	int i, n, rv = -1;
+	unsigned int code, jt, jf, k;
+	struct sock_filter *insns = NULL;
+	struct sock_fprog prog;
+	FILE *f;
+
+	if (!(f = fopen(path, "r")))
+		return -1;
+
+	/* program in "tcpdump -ddd" format: count, then "code jt jf k" lines */
+	if (fscanf(f, "%d", &n) != 1 || n <= 0 || n > BPF_MAXINSNS)
+		goto out;
+
+	if (!(insns = calloc(n, sizeof(*insns))))
+		goto out;
+
+	for (i = 0; i < n; i++)
+	{
+		if (fscanf(f, "%u %u %u %u", &code, &jt, &jf, &k) != 4)
+			goto out;
+
+		insns[i].code = code;
+		insns[i].jt   = jt;
+		insns[i].jf   = jf;
+		insns[i].k    = k;
+	}
+
+	prog.len    = n;
+	prog.filter = insns;
+
+	rv = setsockopt(capture_sock, SOL_SOCKET, SO_ATTACH_FILTER,
+					&prog, sizeof(prog));
+
+out:
+	if (rv && !errno)
+		errno = EINVAL;
+
+	free(insns);
+	fclose(f);
+
+	return rv;
+}
+
+int parse_classes(const char *list)
+{
+	char *p, *s, *tok;
+	int rv = 0;
+
+	if (!(s = strdup(list)))
+		return -1;
+
+	for (tok = strtok_r(s, ",", &p); tok; tok = strtok_r(NULL, ",", &p))
+	{
+		if (!strcmp(tok, "mgmt"))
+			filter_class |= 1 << (FRAMECLASS_MGMT >> 2);
+		else if (!strcmp(tok, "ctrl"))
+			filter_class |= 1 << (FRAMECLASS_CTRL >> 2);
+		else if (!strcmp(tok, "data"))
+			filter_class |= 1 << (FRAMECLASS_DATA >> 2);
+		else
+			rv = -1;
+	}
+
+	free(s);
+
+	return rv;
+}
+
+int radiotap_flags(uint8_t *data, uint16_t rlen)
+{
+	radiotap_hdr_t *rhdr = (radiotap_hdr_t *)data;
+	uint32_t present = le32(rhdr->it_present);
+	uint32_t word = present;
+	uint32_t off = sizeof(*rhdr);
+
+	if (!(present & (1 << RADIOTAP_FLAGS)))
+		return -1;
+
+	/* skip extended presence bitmaps */
+	while (word & (1 << RADIOTAP_EXT))
+	{
+		if (off + 4 > rlen)
+			return -1;
+
+		memcpy(&word, data + off, 4);
+		word = le32(word);
+		off += 4;
+	}
+
+	/* the flags field only follows an 8 byte aligned TSFT */
+	if (present & (1 << RADIOTAP_TSFT))
+		off = ((off + 7) & ~7) + 8;
+
+	if (off >= rlen)
+		return -1;
+
+	return data[off];
+}
+
+uint8_t * ieee80211_bssid(uint8_t *hdr, uint32_t len)
+{
+	if (len < 24)
+		return NULL;
+
+	switch (hdr[0] & FRAMECLASS_MASK)
+	{
+	case FRAMECLASS_MGMT:
+		return hdr + 16;
+
+	case FRAMECLASS_DATA:
+		switch (hdr[1] & (FRAMEFLAG_TODS | FRAMEFLAG_FROMDS))
+		{
+		case 0:
+			return hdr + 16;
+
+		case FRAMEFLAG_TODS:
+			return hdr + 4;
+
+		case FRAMEFLAG_FROMDS:
+			return hdr + 10;
+		}
+	}
+
+	return NULL;
+}
+
+int filter_frame(uint8_t *data, uint32_t len)
+{
+	radiotap_hdr_t *rhdr = (radiotap_hdr_t *)data;
+	uint16_t rlen;
+	uint8_t *hdr, *b;
+	uint8_t frametype;
+	int flags;
+
+	if (len <= sizeof(radiotap_hdr_t) || le16(rhdr->it_len) >= len)
+		return 1;
+
+	rlen = le16(rhdr->it_len);
+	hdr = data + rlen;
+	frametype = hdr[0];
+
+	if ((filter_data   && (frametype & FRAMETYPE_MASK) == FRAMETYPE_DATA) ||
+	    (filter_beacon && (frametype & FRAMETYPE_MASK) == FRAMETYPE_BEACON))
+		return 1;
+
+	if (filter_class &&
+	    !(filter_class & (1 << ((frametype & FRAMECLASS_MASK) >> 2))))
+		return 1;
+
+	if (filter_badfcs)
+	{
+		flags = radiotap_flags(data, rlen);
+
+		if (flags > 0 && (flags & RADIOTAP_F_BADFCS))
+			return 1;
+	}
+
+	if (filter_bssid)
+	{
+		b = ieee80211_bssid(hdr, len - rlen);
+
+		if (!b || memcmp(b, bssid, sizeof(bssid)))
+			return 1;
+	}
+
+	return 0;
+}
+
+void handle_frame(uint8_t *data, uint32_t len, uint32_t olen,
+				  uint32_t sec, uint32_t usec)
+{
+	struct ringbuf_entry *e;
+
+	frames_captured++;
+
+	/* check received frame, if we should filter it, skip the ring */
+	if (filter_frame(data, len))
+	{
+		frames_filtered++;
+		return;
+	}
+
+	if (streaming)
+	{
+		write_pcap_frame(&stream_out, sec, usec, data, len, olen);
+	}
+	else
+	{
+		e = ringbuf_add(ring, sec, usec);
+		e->olen = olen;
+		e->len = (len > pktcap) ? pktcap : len;
+
+		memcpy((void *)e + sizeof(*e), data, e->len);
+	}
+}
+
+void dump_ring(const char *output, int keep)
 {
 	int i, n;
-	struct ringbuf *ring;
 	struct ringbuf_entry *e;
+	struct pcap_out o;
+	struct tpacket_stats_v3 st;
+	socklen_t stlen = sizeof(st);
+
+	msg("Dumping ring to %s ...\n", output);
+
+	pcap_shift(output, keep);
+
+	if (pcap_open(&o, output, pcapng))
+	{
+		msg("Unable to open %s: %s\n",
+			output, strerror(errno));
+		return;
+	}
+
+	/* sig_dump packet buffer */
+	for (i = 0, n = 0; i < ring->len; i++)
+	{
+		if (!(e = ringbuf_get(ring, i)))
+			continue;
+
+		write_pcap_frame(&o, e->sec, e->usec,
+						 (void *)e + sizeof(*e), e->len, e->olen);
+		n++;
+	}
+
+	pcap_close(&o);
+
+	msg(" * %d frames captured\n", frames_captured);
+	msg(" * %d frames filtered\n", frames_filtered);
+	msg(" * %d frames dumped\n", n);
+
+
+	/* counters are reset on every read, so report drops since last dump */
+	if (!getsockopt(capture_sock, SOL_PACKET, PACKET_STATISTICS, &st, &stlen))
+		msg(" * %d frames dropped by kernel\n", st.tp_drops);
+}
+
+
+int main(int argc, char **argv)
+{
+	int i;
+	struct mmap_ring mring = { 0 };
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *ph;
+	struct pollfd pfd;
+	struct timeval tv;
 	struct sockaddr_ll local = {
 		.sll_family   = AF_PACKET,
 		.sll_protocol = htons(ETH_P_ALL)
 	};
 
-	radiotap_hdr_t *rhdr;
-
-	uint8_t frametype;
 	uint8_t pktbuf[0xFFFF];
 	ssize_t pktlen;
 
-	FILE *o;
-
 	int opt;
+	char *end;
+	unsigned long ul;
 
 	uint8_t promisc        = 0;
-	uint8_t streaming      = 0;
 	uint8_t foreground     = 0;
-	uint8_t filter_data    = 0;
-	uint8_t filter_beacon  = 0;
-	uint8_t header_written = 0;
+	uint8_t use_mmap       = 1;
 
 	uint32_t ringsz   = 1024 * 1024; /* 1 Mbyte ring buffer */
-	uint16_t pktcap   = 256;		 /* truncate frames after 265KB */
+	uint32_t kringsz  = 1024 * 1024; /* 1 Mbyte kernel capture ring */
+	uint32_t rotsize  = 0;           /* rotate stream file after bytes */
+	uint32_t rottime  = 0;           /* rotate stream file after seconds */
+	int      keep     = 1;           /* number of output files to keep */
 
 	const char *output = NULL;
+	const char *stream_file = NULL;
+	const char *bpf = NULL;
 
 
-	while ((opt = getopt(argc, argv, "i:r:c:o:sfhBD")) != -1)
+	while ((opt = getopt(argc, argv, "i:r:k:c:o:w:S:T:N:F:t:b:sgfhBDEM")) != -1)
 	{
 		switch (opt)
 		{
@@ -324,6 +910,20 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'k':
+			kringsz = atoi(optarg);
+			if (kringsz < (2 * MMAP_BLOCK_SIZE))
+			{
+				msg("Kernel ring size of %d bytes is too short, "
+					"must be at least %d bytes\n", kringsz, 2 * MMAP_BLOCK_SIZE);
+				return 3;
+			}
+			break;
+
+		case 'M':
+			use_mmap = 0;
+			break;
+
 		case 'c':
 			pktcap = atoi(optarg);
 			if (pktcap <= (sizeof(radiotap_hdr_t) + LEN_IEEE802_11_HDR))
@@ -343,6 +943,68 @@ int main(int argc, char **argv)
 			output = optarg;
 			break;
 
+		case 'w':
+			streaming = 1;
+			stream_file = optarg;
+			break;
+
+		case 'g':
+			pcapng = 1;
+			break;
+
+		case 'S':
+			errno = 0;
+			ul = strtoul(optarg, &end, 10);
+			if (errno || *end || optarg[0] == '-' || ul > UINT32_MAX / 1024)
+			{
+				msg("Invalid rotation size '%s', "
+					"expecting 0 to %u KB\n", optarg, UINT32_MAX / 1024);
+				return 1;
+			}
+			rotsize = ul * 1024;
+			break;
+
+		case 'T':
+			rottime = atoi(optarg);
+			break;
+
+		case 'N':
+			keep = atoi(optarg);
+			if (keep < 1)
+			{
+				msg("Need to keep at least one output file\n");
+				return 1;
+			}
+			break;
+
+		case 'F':
+			bpf = optarg;
+			break;
+
+		case 't':
+			if (parse_classes(optarg))
+			{
+				msg("Invalid frame class list '%s', "
+					"expecting mgmt, ctrl or data\n", optarg);
+				return 1;
+			}
+			break;
+
+		case 'b':
+			if (sscanf(optarg, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+					   &bssid[0], &bssid[1], &bssid[2],
+					   &bssid[3], &bssid[4], &bssid[5]) != 6)
+			{
+				msg("Invalid BSSID '%s'\n", optarg);
+				return 1;
+			}
+			filter_bssid = 1;
+			break;
+
+		case 'E':
+			filter_badfcs = 1;
+			break;
+
 		case 'B':
 			filter_beacon = 1;
 			break;
@@ -358,32 +1020,63 @@ int main(int argc, char **argv)
 		case 'h':
 			msg(
 				"Usage:\n"
-				"  %s -i {iface} -s [-b] [-d]\n"
-				"  %s -i {iface} -o {file} [-r len] [-c len] [-B] [-D] [-f]\n"
+				"  %s -i {iface} -s [filter options] [-g] [-k len] [-M]\n"
+				"  %s -i {iface} -w {file} [filter options] [-g] [-f]\n"
+				"     [-S kbytes] [-T seconds] [-N count] [-k len] [-M]\n"
+				"  %s -i {iface} -o {file} [filter options] [-g] [-f]\n"
+				"     [-r len] [-c len] [-N count] [-k len] [-M]\n"
 				"\n"
 				"  -i iface\n"
 				"    Specify interface to use, must be in monitor mode and\n"
 				"    produce IEEE 802.11 Radiotap headers.\n\n"
 				"  -s\n"
 				"    Stream to stdout instead of Dumping to file on USR1.\n\n"
+				"  -w file\n"
+				"    Stream to given output file instead of stdout.\n\n"
 				"  -o file\n"
 				"    Write current ringbuffer contents to given output file\n"
 				"    on receipt of SIGUSR1.\n\n"
+				"  -g\n"
+				"    Write pcapng instead of classic pcap format.\n\n"
+				"  -S kbytes\n"
+				"    Rotate the -w output file after given amount of KB.\n\n"
+				"  -T seconds\n"
+				"    Rotate the -w output file after given amount of seconds.\n\n"
+				"  -N count\n"
+				"    Keep given number of rotated or dumped files, named\n"
+				"    file, file.1 ... file.N-1. The default is to keep one.\n\n"
 				"  -r len\n"
 				"    Specify the amount of bytes to use for the ringbuffer.\n"
 				"    The default length is %d bytes.\n\n"
 				"  -c len\n"
 				"    Truncate captured packets after given amount of bytes.\n"
 				"    The default size limit is %d bytes.\n\n"
+				"  -k len\n"
+				"    Specify the amount of bytes to use for the kernel\n"
+				"    capture ring, rounded down to %d byte blocks.\n"
+				"    The default length is %d bytes.\n\n"
+				"  -M\n"
+				"    Do not use the memory mapped kernel capture ring but\n"
+				"    receive frames one by one.\n\n"
 				"  -B\n"
 				"    Don't store beacon frames in ring, default is keep.\n\n"
 				"  -D\n"
 				"    Don't store data frames in ring, default is keep.\n\n"
+				"  -t class[,class...]\n"
+				"    Only store mgmt, ctrl and/or data frames in ring.\n\n"
+				"  -b bssid\n"
+				"    Only store frames belonging to the given BSSID.\n\n"
+				"  -E\n"
+				"    Don't store frames flagged with a bad FCS by radiotap.\n\n"
+				"  -F file\n"
+				"    Attach the BPF program in given file to the socket,\n"
+				"    e.g. from: tcpdump -y IEEE802_11_RADIO -ddd 'type mgt'\n\n"
 				"  -f\n"
 				"    Do not daemonize but keep running in foreground.\n\n"
 				"  -h\n"
 				"    Display this help.\n\n",
-				argv[0], argv[0], ringsz, pktcap);
+				argv[0], argv[0], argv[0], ringsz, pktcap,
+				MMAP_BLOCK_SIZE, kringsz);
 
 			return 1;
 		}
@@ -397,11 +1090,11 @@ int main(int argc, char **argv)
 
 	if (streaming && output)
 	{
-		msg("The -s and -o options are exclusive\n");
+		msg("The -s, -w and -o options are exclusive\n");
 		return 1;
 	}
 
-	if (streaming && isatty(1))
+	if (streaming && !stream_file && isatty(1))
 	{
 		msg("Refusing to stream into a terminal\n");
 		return 1;
@@ -426,6 +1119,21 @@ int main(int argc, char **argv)
 		return 6;
 	}
 
+	if (bpf && attach_bpf(bpf))
+	{
+		msg("Unable to attach BPF program %s: %s\n",
+			bpf, strerror(errno));
+		return 6;
+	}
+
+	if (use_mmap &&
+	    mmap_ring_init(&mring, MMAP_BLOCK_SIZE, kringsz / MMAP_BLOCK_SIZE))
+	{
+		msg("Unable to set up capture ring, falling back to recvfrom: %s\n",
+			strerror(errno));
+		use_mmap = 0;
+	}
+
 	if (bind(capture_sock, (struct sockaddr *)&local, sizeof(local)) == -1)
 	{
 		msg("Unable to bind to interface: %s\n",
@@ -433,7 +1141,7 @@ int main(int argc, char **argv)
 		return 7;
 	}
 
-	if (!streaming)
+	if (!streaming || stream_file)
 	{
 		if (!foreground)
 		{
@@ -457,7 +1165,10 @@ int main(int argc, char **argv)
 					return 0;
 			}
 		}
+	}
 
+	if (!streaming)
+	{
 		msg("Monitoring interface %s ...\n", ifname);
 
 		if (!(ring = ringbuf_init(ringsz / pktcap, pktcap)))
@@ -476,17 +1187,66 @@ int main(int argc, char **argv)
 	else
 	{
 		msg("Monitoring interface %s ...\n", ifname);
-		msg(" * Streaming data to stdout\n");
+
+		if (!stream_file)
+			msg(" * Streaming data to stdout\n");
+		else
+			msg(" * Streaming data to file %s\n", stream_file);
+
+		if (stream_file && rotsize)
+			msg(" * Rotating after %u bytes\n", rotsize);
+
+		if (stream_file && rottime)
+			msg(" * Rotating after %d seconds\n", rottime);
 	}
 
+	if (pcapng)
+		msg(" * Writing pcapng format\n");
+
+	if (use_mmap)
+		msg(" * Using %d bytes kernel capture ring with %d blocks\n",
+			mring.bsize * mring.bnum, mring.bnum);
+
 	msg(" * Beacon frames are %sfiltered\n", filter_beacon ? "" : "not ");
 	msg(" * Data frames are %sfiltered\n", filter_data ? "" : "not ");
 
+	if (filter_class)
+		msg(" * Only %s%s%sframes are kept\n",
+			(filter_class & (1 << (FRAMECLASS_MGMT >> 2))) ? "mgmt " : "",
+			(filter_class & (1 << (FRAMECLASS_CTRL >> 2))) ? "ctrl " : "",
+			(filter_class & (1 << (FRAMECLASS_DATA >> 2))) ? "data " : "");
+
+	if (filter_bssid)
+		msg(" * Only frames of BSSID %02x:%02x:%02x:%02x:%02x:%02x are kept\n",
+			bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]);
+
+	if (filter_badfcs)
+		msg(" * Frames with bad FCS are filtered\n");
+
+	if (bpf)
+		msg(" * Using BPF program %s\n", bpf);
+
 	signal(SIGINT, sig_teardown);
 	signal(SIGTERM, sig_teardown);
 
 	promisc = set_promisc(1);
 
+	if (streaming)
+	{
+		if (stream_file)
+			pcap_shift(stream_file, keep);
+
+		if (pcap_open(&stream_out, stream_file, pcapng))
+		{
+			msg("Unable to open %s: %s\n",
+				stream_file, strerror(errno));
+			return 9;
+		}
+	}
+
+	pfd.fd = capture_sock;
+	pfd.events = POLLIN | POLLERR;
+
 	/* capture loop */
 	while (1)
 	{
@@ -500,82 +1260,74 @@ int main(int argc, char **argv)
 			if (ring)
 				ringbuf_free(ring);
 
+			if (streaming)
+				pcap_close(&stream_out);
+
+			mmap_ring_free(&mring);
+
 			return 0;
 		}
 		else if (run_dump)
 		{
-			msg("Dumping ring to %s ...\n", output);
+			dump_ring(output, keep);
+			run_dump = 0;
+		}
 
-			if (!(o = fopen(output, "w")))
+		if (use_mmap)
+		{
+			if (!(bd = mmap_ring_next(&mring)))
 			{
-				msg("Unable to open %s: %s\n",
-					output, strerror(errno));
+				/* interrupted by a signal or timed out, recheck flags
+				 * and the rotation deadline */
+				poll(&pfd, 1, 1000);
 			}
 			else
 			{
-				write_pcap_header(o);
+				ph = (void *)bd + bd->hdr.bh1.offset_to_first_pkt;
 
-				/* sig_dump packet buffer */
-				for (i = 0, n = 0; i < ring->len; i++)
+				for (i = 0; i < bd->hdr.bh1.num_pkts; i++)
 				{
-					if (!(e = ringbuf_get(ring, i)))
-						continue;
+					handle_frame((uint8_t *)ph + ph->tp_mac,
+								 ph->tp_snaplen, ph->tp_len,
+								 ph->tp_sec, ph->tp_nsec / 1000);
 
-					write_pcap_frame(o, &(e->sec), &(e->usec), e->len, e->olen);
-					fwrite((void *)e + sizeof(*e), 1, e->len, o);
-					n++;
+					ph = (void *)ph + ph->tp_next_offset;
 				}
 
-				fclose(o);
+				/* streamed frames point into the block, flush before release */
+				if (streaming)
+					pcap_flush(&stream_out);
 
-				msg(" * %d frames captured\n", frames_captured);
-				msg(" * %d frames filtered\n", frames_filtered);
-				msg(" * %d frames dumped\n", n);
+				mmap_ring_release(&mring, bd);
 			}
-
-			run_dump = 0;
 		}
-
-		pktlen = recvfrom(capture_sock, pktbuf, sizeof(pktbuf), 0, NULL, 0);
-		frames_captured++;
-
-		/* check received frametype, if we should filter it, rewind the ring */
-		rhdr = (radiotap_hdr_t *)pktbuf;
-
-		if (pktlen <= sizeof(radiotap_hdr_t) || le16(rhdr->it_len) >= pktlen)
+		else if (poll(&pfd, 1, 1000) > 0)
 		{
-			frames_filtered++;
-			continue;
-		}
+			pktlen = recvfrom(capture_sock, pktbuf, sizeof(pktbuf), 0, NULL, 0);
 
-		frametype = *(uint8_t *)(pktbuf + le16(rhdr->it_len));
+			if (pktlen >= 0)
+			{
+				gettimeofday(&tv, NULL);
+				handle_frame(pktbuf, pktlen, pktlen, tv.tv_sec, tv.tv_usec);
 
-		if ((filter_data   && (frametype & FRAMETYPE_MASK) == FRAMETYPE_DATA) ||
-		    (filter_beacon && (frametype & FRAMETYPE_MASK) == FRAMETYPE_BEACON))
-		{
-			frames_filtered++;
-			continue;
+				if (streaming)
+					pcap_flush(&stream_out);
+			}
 		}
 
-		if (streaming)
+		if (stream_file &&
+		    ((rotsize && stream_out.size >= rotsize) ||
+		     (rottime && uptime() - stream_out.opened >= rottime)))
 		{
-			if (!header_written)
+			pcap_close(&stream_out);
+			pcap_shift(stream_file, keep);
+
+			if (pcap_open(&stream_out, stream_file, pcapng))
 			{
-				write_pcap_header(stdout);
-				header_written = 1;
+				msg("Unable to open %s: %s\n",
+					stream_file, strerror(errno));
+				run_stop = 1;
 			}
-
-			write_pcap_frame(stdout, NULL, NULL, pktlen, pktlen);
-			fwrite(pktbuf, 1, pktlen, stdout);
-			fflush(stdout);
-		}
-		else
-		{
-			e = ringbuf_add(ring);
-			e->olen = pktlen;
-			e->len = (pktlen > pktcap) ? pktcap : pktlen;
-
-			memcpy((void *)e + sizeof(*e), pktbuf, e->len);
 		}
 	}
 
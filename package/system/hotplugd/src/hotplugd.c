@@ -0,0 +1,1164 @@
+/*
+ * hotplugd - hotplug event dispatcher with cached handler lists
+ *
+ *   Copyright (C) 2015 OpenWrt.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * The daemon keeps the sorted script list of every /etc/hotplug.d/<subsystem>
+ * directory in memory and drops it whenever inotify reports a change. Events
+ * are handed to one long-lived shell per subsystem, which already has
+ * /lib/functions.sh loaded and gets every handler preloaded as a shell
+ * function. Handlers are called from that shell directly, with "exit"
+ * aliased to "return" and every variable they assign declared local, so
+ * they see the same environment /sbin/hotplug-call would set up and leave
+ * nothing behind for the next one. Handlers doing anything that could
+ * change the shell state beyond that (cd, set, trap, eval, sourcing other
+ * files, calling library functions, ...) are still run in a subshell.
+ *
+ * procd runs "hotplugd -c <subsystem>" for every event, which passes its
+ * environment to the daemon and waits until all handlers have completed, so
+ * the order in which procd and netifd see events being processed does not
+ * change. /sbin/hotplug-call does the same for all other callers.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <poll.h>
+#include <time.h>
+#include <syslog.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+
+#ifndef HOTPLUG_DIR
+#define HOTPLUG_DIR		"/etc/hotplug.d"
+#endif
+
+#ifndef HOTPLUG_CALL
+#define HOTPLUG_CALL	"/sbin/hotplug-call"
+#endif
+
+#ifndef HOTPLUG_FUNCS
+#define HOTPLUG_FUNCS	"/lib/functions.sh"
+#endif
+
+#ifndef HOTPLUG_UCI
+#define HOTPLUG_UCI		"/lib/config/uci.sh"
+#endif
+
+#define HOTPLUGD_SOCK	"/var/run/hotplugd.sock"
+
+#define MAX_CONNS		32
+#define MAX_SUBSYS		32
+#define MAX_EVENT_LEN	(64 * 1024)
+#define MAX_SCRIPT_LEN	(64 * 1024)
+
+#define INOTIFY_MASK	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+						 IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | \
+						 IN_CLOSE_WRITE)
+
+/* reads one length-prefixed command per event and acks it on fd 3, the
+ * command is kept in $1 so handlers do not see any variables of ours */
+static const char worker_script[] =
+	". " HOTPLUG_FUNCS "\n"
+	"while read -r n; do\n"
+	"	cmd=\n"
+	"	while [ $n -gt 0 ] && IFS= read -r line; do\n"
+	"		cmd=\"$cmd$line\n\"\n"
+	"		n=$((n - 1))\n"
+	"	done\n"
+	"	set -- \"$cmd\"\n"
+	"	unset n cmd line\n"
+	"	eval \"$1\" </dev/null 3>&-\n"
+	"	echo >&3\n"
+	"done\n";
+
+/* builtins and keywords which change the shell beyond plain variables */
+static const char *unsafe_words[] = {
+	"alias", "builtin", "cd", "command", "declare", "eval", "exec",
+	"function", "getopts", "hash", "let", "read", "readonly", "set",
+	"shift", "source", "trap", "typeset", "ulimit", "umask", "unalias",
+	"unset", "wait", NULL
+};
+
+/* words after which a "$..." is run as a command */
+static const char *cmd_words[] = {
+	"do", "elif", "else", "if", "then", "time", "until", "while", NULL
+};
+
+/* variables hotplug-call sets itself or which belong to the calling shell */
+static const char *env_skip[] = {
+	"PATH=", "LOGNAME=", "USER=", "HOTPLUG_TYPE=", "DEVICENAME=",
+	"PWD=", "SHLVL=", "_=", "HOTPLUGD_BYPASS=", NULL
+};
+
+struct buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+struct conn {
+	int fd;
+	struct buf in;
+};
+
+struct handler {
+	char *path;
+	char *func;              /* definition passed to the worker */
+};
+
+struct request {
+	struct request *next;
+	int fd;                  /* client waiting for completion */
+	struct buf env;          /* "VAR=value\0" list */
+};
+
+struct subsys {
+	char name[32];
+
+	/* cached handler list */
+	int valid;
+	int n_scripts;
+	struct handler *scripts;
+
+	/* shell worker */
+	pid_t pid;
+	int cmd_fd;
+	int ack_fd;
+	int busy;
+	int defined;             /* worker has the current handlers loaded */
+	struct buf vars;         /* " VAR VAR ... " of the last event */
+
+	/* pending events, the head one is running while busy */
+	struct request *head, *tail;
+
+	/* last dispatched event, for coalescing */
+	struct buf last;
+	struct timespec last_ts;
+};
+
+static struct conn conns[MAX_CONNS];
+static struct subsys *subsystems[MAX_SUBSYS];
+static int n_subsystems;
+
+/* " name name ... " of the functions in the shell libraries */
+static struct buf lib_funcs;
+
+static int listen_fd = -1;
+static int inotify_fd = -1;
+static int coalesce_ms = 50;
+static int verbose;
+
+static unsigned long events_run, events_coalesced;
+
+
+static void msg(int prio, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (prio == LOG_DEBUG && !verbose)
+		return;
+
+	va_start(ap, fmt);
+	vsyslog(prio, fmt, ap);
+	va_end(ap);
+}
+
+static int buf_put(struct buf *b, const void *data, size_t len)
+{
+	char *n;
+	size_t size = b->size ? b->size : 256;
+
+	while (b->len + len + 1 > size)
+		size *= 2;
+
+	if (size != b->size) {
+		if (!(n = realloc(b->data, size)))
+			return -1;
+
+		b->data = n;
+		b->size = size;
+	}
+
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	b->data[b->len] = 0;
+
+	return 0;
+}
+
+static int buf_puts(struct buf *b, const char *s)
+{
+	return buf_put(b, s, strlen(s));
+}
+
+/* append s as a single quoted shell word */
+static int buf_putq(struct buf *b, const char *s, size_t len)
+{
+	const char *p;
+
+	buf_put(b, "'", 1);
+
+	while ((p = memchr(s, '\'', len)) != NULL) {
+		buf_put(b, s, p - s);
+		buf_put(b, "'\\''", 4);
+		len -= p - s + 1;
+		s = p + 1;
+	}
+
+	buf_put(b, s, len);
+
+	return buf_put(b, "'", 1);
+}
+
+static void buf_free(struct buf *b)
+{
+	free(b->data);
+	memset(b, 0, sizeof(*b));
+}
+
+static void set_nonblock(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static int valid_subsys(const char *name)
+{
+	if (!*name || strlen(name) >= sizeof(((struct subsys *)0)->name))
+		return 0;
+
+	if (!strcmp(name, ".") || !strcmp(name, "..") || strchr(name, '/'))
+		return 0;
+
+	return 1;
+}
+
+static int ident_char(char c)
+{
+	return c == '_' ||
+	       (c >= 'a' && c <= 'z') ||
+	       (c >= 'A' && c <= 'Z') ||
+	       (c >= '0' && c <= '9');
+}
+
+static int valid_var(const char *s, size_t len)
+{
+	size_t i;
+
+	if (!len || (s[0] >= '0' && s[0] <= '9'))
+		return 0;
+
+	for (i = 0; i < len; i++)
+		if (!ident_char(s[i]))
+			return 0;
+
+	return 1;
+}
+
+static int skip_var(const char *s)
+{
+	int i;
+
+	for (i = 0; env_skip[i]; i++)
+		if (!strncmp(s, env_skip[i], strlen(env_skip[i])))
+			return 1;
+
+	return 0;
+}
+
+static int word_in(const char **list, const char *w, size_t len)
+{
+	for (; *list; list++)
+		if (strlen(*list) == len && !memcmp(*list, w, len))
+			return 1;
+
+	return 0;
+}
+
+/* word lists are kept as " word word ... " */
+static int word_listed(struct buf *b, const char *w, size_t len)
+{
+	const char *p, *e;
+
+	for (p = b->data; p && *p; p = e) {
+		p += strspn(p, " ");
+		e = p + strcspn(p, " ");
+
+		if ((size_t)(e - p) == len && !memcmp(p, w, len))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void word_add(struct buf *b, const char *w, size_t len)
+{
+	if (word_listed(b, w, len))
+		return;
+
+	buf_put(b, " ", 1);
+	buf_put(b, w, len);
+}
+
+/* remember which functions handlers get from the shell libraries */
+static void lib_funcs_load(const char *path)
+{
+	char line[256], *p, *e;
+	FILE *f;
+
+	if (!(f = fopen(path, "r")))
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		p = line + strspn(line, " \t");
+
+		for (e = p; ident_char(*e); e++);
+
+		if (e > p && !strncmp(e + strspn(e, " \t"), "()", 2))
+			word_add(&lib_funcs, p, e - p);
+	}
+
+	fclose(f);
+}
+
+/* whether the shell expects a command name at p */
+static int cmd_position(const char *text, const char *p)
+{
+	const char *e;
+
+	while (p > text && strchr(" \t\"'", p[-1]))
+		p--;
+
+	if (p == text || strchr("\n;&|(){`!", p[-1]))
+		return 1;
+
+	for (e = p; p > text && ident_char(p[-1]); p--);
+
+	return word_in(cmd_words, p, e - p);
+}
+
+/*
+ * Decide whether a handler can be called in the worker shell itself and
+ * collect the variables it assigns. Anything not understood here makes
+ * the handler run in a subshell, so this only needs to be conservative:
+ * function definitions, $$, arithmetic side effects, commands taken from
+ * variables, sourcing, library calls and the builtins in unsafe_words
+ * all count.
+ */
+static int handler_inline(const char *text, struct buf *locals)
+{
+	const char *p, *w;
+	size_t len;
+
+	if (strstr(text, "()") || strstr(text, "$$"))
+		return 0;
+
+	if (strstr(text, "((")) {
+		if (strstr(text, "++") || strstr(text, "--"))
+			return 0;
+
+		for (p = text; (p = strchr(p + 1, '=')) != NULL; )
+			if (strchr("+-*/%&|^<>", p[-1]))
+				return 0;
+	}
+
+	for (p = text; *p; ) {
+		if (*p == '$' || (*p == '.' && (p[1] == ' ' || p[1] == '\t'))) {
+			if (cmd_position(text, p))
+				return 0;
+
+			p++;
+			continue;
+		}
+
+		if (!ident_char(*p)) {
+			p++;
+			continue;
+		}
+
+		for (w = p; ident_char(*p); p++);
+		len = p - w;
+
+		/* numbers and variable references */
+		if ((*w >= '0' && *w <= '9') || (w > text && w[-1] == '$'))
+			continue;
+
+		if (word_in(unsafe_words, w, len) || word_listed(&lib_funcs, w, len))
+			return 0;
+
+		if (*p == '=' || (*p == '+' && p[1] == '=') ||
+		    (*p == ':' && p[1] == '=')) {
+			/* but not options like --foo=bar */
+			if (w == text || !strchr("-./", w[-1]))
+				word_add(locals, w, len);
+		} else if (len == 3 && !memcmp(w, "for", 3)) {
+			p += strspn(p, " \t");
+
+			for (w = p; ident_char(*p); p++);
+
+			if (p > w)
+				word_add(locals, w, p - w);
+		}
+	}
+
+	return 1;
+}
+
+static void handler_load(struct handler *h, int idx)
+{
+	struct buf text = { 0 }, locals = { 0 }, func = { 0 };
+	char buf[4096];
+	ssize_t len = -1;
+	int fd;
+
+	if ((fd = open(h->path, O_RDONLY)) >= 0) {
+		while (text.len <= MAX_SCRIPT_LEN &&
+		       (len = read(fd, buf, sizeof(buf))) > 0)
+			buf_put(&text, buf, len);
+
+		close(fd);
+	}
+
+	if (!len && text.len && strlen(text.data) == text.len &&
+	    handler_inline(text.data, &locals)) {
+		snprintf(buf, sizeof(buf), "hotplug_%d() {\n", idx);
+		buf_puts(&func, buf);
+
+		if (locals.len) {
+			buf_puts(&func, "local");
+			buf_put(&func, locals.data, locals.len);
+			buf_puts(&func, "\n");
+		}
+
+		buf_put(&func, text.data, text.len);
+		buf_puts(&func, "\n}");
+
+		h->func = func.data;
+	}
+
+	msg(LOG_DEBUG, "%s runs %s\n", h->path,
+	    h->func ? "inline" : "in a subshell");
+
+	buf_free(&text);
+	buf_free(&locals);
+}
+
+
+static void scripts_free(struct subsys *s)
+{
+	int i;
+
+	for (i = 0; i < s->n_scripts; i++) {
+		free(s->scripts[i].path);
+		free(s->scripts[i].func);
+	}
+
+	free(s->scripts);
+
+	s->scripts = NULL;
+	s->n_scripts = 0;
+	s->valid = 0;
+}
+
+static int script_filter(const struct dirent *e)
+{
+	return e->d_name[0] != '.';
+}
+
+static void scripts_load(struct subsys *s)
+{
+	struct dirent **list;
+	struct stat st;
+	char path[PATH_MAX];
+	int i, n;
+
+	scripts_free(s);
+
+	snprintf(path, sizeof(path), "%s/%s", HOTPLUG_DIR, s->name);
+
+	if (inotify_fd >= 0)
+		inotify_add_watch(inotify_fd, path, INOTIFY_MASK);
+
+	/* same order as the ls based listing in hotplug-call */
+	n = scandir(path, &list, script_filter, alphasort);
+
+	if (n > 0) {
+		s->scripts = calloc(n, sizeof(*s->scripts));
+
+		for (i = 0; i < n; i++) {
+			snprintf(path, sizeof(path), "%s/%s/%s",
+			         HOTPLUG_DIR, s->name, list[i]->d_name);
+
+			if (s->scripts && !stat(path, &st) && S_ISREG(st.st_mode)) {
+				s->scripts[s->n_scripts].path = strdup(path);
+				handler_load(&s->scripts[s->n_scripts], s->n_scripts);
+				s->n_scripts++;
+			}
+
+			free(list[i]);
+		}
+
+		free(list);
+	}
+
+	s->valid = 1;
+	s->defined = 0;
+
+	msg(LOG_DEBUG, "loaded %d handlers for %s\n", s->n_scripts, s->name);
+}
+
+static void scripts_invalidate(void)
+{
+	char buf[4096];
+	int i;
+
+	/* drain the queue, any change simply invalidates all caches */
+	while (read(inotify_fd, buf, sizeof(buf)) > 0);
+
+	for (i = 0; i < n_subsystems; i++)
+		scripts_free(subsystems[i]);
+}
+
+
+static int worker_start(struct subsys *s)
+{
+	int cmd[2], ack[2];
+	char type[sizeof(s->name) + sizeof("HOTPLUG_TYPE=")];
+
+	if (pipe(cmd))
+		return -1;
+
+	if (pipe(ack)) {
+		close(cmd[0]);
+		close(cmd[1]);
+		return -1;
+	}
+
+	switch ((s->pid = fork())) {
+	case -1:
+		close(cmd[0]);
+		close(cmd[1]);
+		close(ack[0]);
+		close(ack[1]);
+		s->pid = 0;
+		return -1;
+
+	case 0:
+		close(cmd[1]);
+		close(ack[0]);
+
+		dup2(cmd[0], 0);
+		dup2(ack[1], 3);
+
+		if (cmd[0] > 3)
+			close(cmd[0]);
+
+		if (ack[1] > 3)
+			close(ack[1]);
+
+		/* handlers see the environment hotplug-call used to set up */
+		snprintf(type, sizeof(type), "HOTPLUG_TYPE=%s", s->name);
+
+		clearenv();
+		putenv(type);
+		setenv("PATH", "/bin:/sbin:/usr/bin:/usr/sbin", 1);
+		setenv("LOGNAME", "root", 1);
+		setenv("USER", "root", 1);
+
+		/* nested hotplug-call invocations must not wait for us */
+		setenv("HOTPLUGD_BYPASS", "1", 1);
+
+		execl("/bin/sh", "sh", "-c", worker_script, HOTPLUG_CALL, NULL);
+		_exit(255);
+	}
+
+	close(cmd[0]);
+	close(ack[1]);
+
+	s->cmd_fd = cmd[1];
+	s->ack_fd = ack[0];
+	s->defined = 0;
+	s->vars.len = 0;
+
+	fcntl(s->cmd_fd, F_SETFD, FD_CLOEXEC);
+	set_nonblock(s->ack_fd);
+
+	msg(LOG_DEBUG, "started worker %d for %s\n", s->pid, s->name);
+
+	return 0;
+}
+
+static void worker_stop(struct subsys *s)
+{
+	if (!s->pid)
+		return;
+
+	close(s->cmd_fd);
+	close(s->ack_fd);
+	waitpid(s->pid, NULL, 0);
+
+	s->pid = 0;
+	s->cmd_fd = -1;
+	s->ack_fd = -1;
+}
+
+static int worker_send(struct subsys *s, struct request *r)
+{
+	struct buf cmd = { 0 };
+	char hdr[32];
+	const char *p, *eq;
+	ssize_t len;
+	size_t off;
+	int i, lines = 0;
+
+	/* (re)define the handler functions, "exit" ends just the handler */
+	if (!s->defined) {
+		buf_puts(&cmd, "alias exit=return\n");
+
+		for (i = 0; i < s->n_scripts; i++) {
+			snprintf(hdr, sizeof(hdr), "hotplug_%d", i);
+
+			/* handlers which do not parse fail when called, as before */
+			if (s->scripts[i].func) {
+				buf_puts(&cmd, "def=");
+				buf_putq(&cmd, s->scripts[i].func, strlen(s->scripts[i].func));
+				buf_puts(&cmd, "\n( eval \"$def\" ) 2>/dev/null && eval \"$def\" ||\n");
+			}
+
+			buf_puts(&cmd, hdr);
+			buf_puts(&cmd, "() { ( [ -f $script ] && . $script ); }\n");
+		}
+
+		buf_puts(&cmd, "unalias exit\nunset def\n");
+	}
+
+	/* variables of the previous event must not leak into this one */
+	if (s->vars.len) {
+		buf_puts(&cmd, "unset");
+		buf_put(&cmd, s->vars.data, s->vars.len);
+		buf_puts(&cmd, "\n");
+		s->vars.len = 0;
+	}
+
+	for (p = r->env.data; p < r->env.data + r->env.len; p += strlen(p) + 1) {
+		if (skip_var(p) || !(eq = strchr(p, '=')) || !valid_var(p, eq - p))
+			continue;
+
+		buf_puts(&cmd, "export ");
+		buf_put(&cmd, p, eq - p + 1);
+		buf_putq(&cmd, eq + 1, strlen(eq + 1));
+		buf_puts(&cmd, "\n");
+
+		word_add(&s->vars, p, eq - p);
+	}
+
+	buf_puts(&cmd, "export DEVICENAME=\"${DEVPATH##*/}\"\n");
+
+	for (i = 0; i < s->n_scripts; i++) {
+		snprintf(hdr, sizeof(hdr), "hotplug_%d", i);
+
+		buf_puts(&cmd, "script=");
+		buf_putq(&cmd, s->scripts[i].path, strlen(s->scripts[i].path));
+		buf_puts(&cmd, "; ");
+		buf_puts(&cmd, hdr);
+		buf_puts(&cmd, " \"$HOTPLUG_TYPE\"\n");
+	}
+
+	if (!cmd.data)
+		return -1;
+
+	for (p = cmd.data; (p = strchr(p, '\n')) != NULL; p++)
+		lines++;
+
+	snprintf(hdr, sizeof(hdr), "%d\n", lines);
+
+	/* the worker is idle while we write, so blocking writes are fine */
+	if (write(s->cmd_fd, hdr, strlen(hdr)) != (ssize_t)strlen(hdr))
+		goto err;
+
+	for (off = 0; off < cmd.len; off += len) {
+		len = write(s->cmd_fd, cmd.data + off, cmd.len - off);
+
+		if (len < 0 && errno == EINTR)
+			len = 0;
+		else if (len < 0)
+			goto err;
+	}
+
+	buf_free(&cmd);
+	s->defined = 1;
+	return 0;
+
+err:
+	buf_free(&cmd);
+	return -1;
+}
+
+
+static struct subsys * subsys_get(const char *name)
+{
+	struct subsys *s;
+	int i;
+
+	for (i = 0; i < n_subsystems; i++)
+		if (!strcmp(subsystems[i]->name, name))
+			return subsystems[i];
+
+	if (n_subsystems == MAX_SUBSYS || !(s = calloc(1, sizeof(*s))))
+		return NULL;
+
+	strcpy(s->name, name);
+	s->cmd_fd = -1;
+	s->ack_fd = -1;
+
+	subsystems[n_subsystems++] = s;
+
+	return s;
+}
+
+/* event environment without the per-uevent sequence number */
+static void event_key(struct buf *key, struct buf *env)
+{
+	const char *p;
+
+	key->len = 0;
+
+	for (p = env->data; p < env->data + env->len; p += strlen(p) + 1)
+		if (strncmp(p, "SEQNUM=", 7))
+			buf_put(key, p, strlen(p) + 1);
+}
+
+static int event_duplicate(struct subsys *s, struct request *r)
+{
+	struct buf key = { 0 };
+	struct timespec now;
+	long ms;
+	int dup;
+
+	if (coalesce_ms <= 0 || !s->last.len)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	ms = (now.tv_sec - s->last_ts.tv_sec) * 1000 +
+	     (now.tv_nsec - s->last_ts.tv_nsec) / 1000000;
+
+	if (ms > coalesce_ms)
+		return 0;
+
+	event_key(&key, &r->env);
+	dup = (key.len == s->last.len && !memcmp(key.data, s->last.data, key.len));
+	buf_free(&key);
+
+	return dup;
+}
+
+/* ack 0 tells the client the event was handled, anything else makes it
+ * fall back to running hotplug-call itself */
+static void request_finish(struct request *r, char ack)
+{
+	if (r->fd >= 0) {
+		if (write(r->fd, &ack, 1) < 0)
+			msg(LOG_DEBUG, "client went away: %s\n", strerror(errno));
+
+		close(r->fd);
+	}
+
+	buf_free(&r->env);
+	free(r);
+}
+
+static void subsys_run(struct subsys *s)
+{
+	struct request *r;
+	char ack;
+
+	while (!s->busy && (r = s->head) != NULL) {
+		if (!s->valid)
+			scripts_load(s);
+
+		ack = 0;
+
+		if (event_duplicate(s, r)) {
+			events_coalesced++;
+		} else if (s->n_scripts > 0) {
+			if (!s->pid && worker_start(s)) {
+				msg(LOG_ERR, "unable to start worker for %s: %s\n",
+				    s->name, strerror(errno));
+				ack = 1;
+			} else if (worker_send(s, r)) {
+				msg(LOG_ERR, "unable to pass event to %s worker: %s\n",
+				    s->name, strerror(errno));
+				worker_stop(s);
+				ack = 1;
+			} else {
+				/* the coalescing window starts with the run, events
+				 * folded into it must not extend it */
+				event_key(&s->last, &r->env);
+				clock_gettime(CLOCK_MONOTONIC, &s->last_ts);
+
+				s->busy = 1;
+				events_run++;
+				return;
+			}
+		}
+
+		s->head = r->next;
+
+		if (!s->head)
+			s->tail = NULL;
+
+		request_finish(r, ack);
+	}
+}
+
+static void subsys_ack(struct subsys *s)
+{
+	struct request *r;
+	char buf[16];
+	ssize_t i, len;
+
+	len = read(s->ack_fd, buf, sizeof(buf));
+
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	/* worker died, finish the running event and respawn on demand */
+	if (len <= 0) {
+		msg(LOG_WARNING, "worker for %s exited\n", s->name);
+		worker_stop(s);
+		len = s->busy;
+		memset(buf, '\n', len);
+	}
+
+	for (i = 0; i < len; i++) {
+		if (!s->busy || !(r = s->head))
+			break;
+
+		s->head = r->next;
+
+		if (!s->head)
+			s->tail = NULL;
+
+		s->busy = 0;
+		request_finish(r, 0);
+	}
+
+	subsys_run(s);
+}
+
+static void event_dispatch(int fd, struct buf *in)
+{
+	struct subsys *s;
+	struct request *r;
+	const char *name = in->data;
+	size_t nlen;
+
+	if (!name || !(nlen = strnlen(name, in->len)) || nlen == in->len ||
+	    !valid_subsys(name) || !(s = subsys_get(name)) ||
+	    !(r = calloc(1, sizeof(*r)))) {
+		close(fd);
+		return;
+	}
+
+	r->fd = fd;
+	buf_put(&r->env, name + nlen + 1, in->len - nlen - 1);
+
+	if (s->tail)
+		s->tail->next = r;
+	else
+		s->head = r;
+
+	s->tail = r;
+
+	subsys_run(s);
+}
+
+
+static void conn_accept(void)
+{
+	int i, fd;
+
+	if ((fd = accept(listen_fd, NULL, NULL)) < 0)
+		return;
+
+	for (i = 0; i < MAX_CONNS; i++) {
+		if (conns[i].fd < 0) {
+			set_nonblock(fd);
+			conns[i].fd = fd;
+			conns[i].in.len = 0;
+			return;
+		}
+	}
+
+	close(fd);
+}
+
+static void conn_read(struct conn *c)
+{
+	char buf[4096];
+	ssize_t len;
+
+	while ((len = read(c->fd, buf, sizeof(buf))) > 0) {
+		if (c->in.len + len > MAX_EVENT_LEN || buf_put(&c->in, buf, len)) {
+			len = -1;
+			errno = EMSGSIZE;
+			break;
+		}
+	}
+
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	/* the client shuts down its write side after the last variable */
+	if (len == 0)
+		event_dispatch(c->fd, &c->in);
+	else
+		close(c->fd);
+
+	c->fd = -1;
+	buf_free(&c->in);
+}
+
+
+/* let the shell implementation handle the event */
+static int run_fallback(const char *name)
+{
+	setenv("HOTPLUGD_BYPASS", "1", 1);
+	execl(HOTPLUG_CALL, HOTPLUG_CALL, name, NULL);
+	return 1;
+}
+
+/*
+ * The daemon closes the connection without an ack if it can not take the
+ * event (too many clients or subsystems, oversized event), so anything but
+ * a zero ack falls back to hotplug-call instead of losing the event.
+ */
+static int run_client(const char *path, const char *name)
+{
+	extern char **environ;
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	char ack, **e;
+	struct buf out = { 0 };
+	size_t off;
+	ssize_t len;
+	int fd;
+
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    connect(fd, (struct sockaddr *)&sun, sizeof(sun)))
+		return run_fallback(name);
+
+	buf_put(&out, name, strlen(name) + 1);
+
+	for (e = environ; *e; e++)
+		buf_put(&out, *e, strlen(*e) + 1);
+
+	for (off = 0; off < out.len; off += len) {
+		len = write(fd, out.data + off, out.len - off);
+
+		if (len < 0 && errno == EINTR)
+			len = 0;
+		else if (len < 0)
+			goto fallback;
+	}
+
+	shutdown(fd, SHUT_WR);
+
+	while ((len = read(fd, &ack, 1)) < 0 && errno == EINTR);
+
+	if (len == 1 && ack == 0)
+		return 0;
+
+fallback:
+	close(fd);
+	return run_fallback(name);
+}
+
+static int listen_sock(const char *path)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	int fd;
+
+	strncpy(sun.sun_path, path, sizeof(sun.sun_path) - 1);
+	unlink(path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+
+	if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) ||
+	    chmod(path, 0600) || listen(fd, MAX_CONNS)) {
+		close(fd);
+		return -1;
+	}
+
+	set_nonblock(fd);
+
+	return fd;
+}
+
+static volatile sig_atomic_t do_exit, do_stats;
+
+static void handle_signal(int sig)
+{
+	if (sig == SIGUSR1)
+		do_stats = 1;
+	else
+		do_exit = 1;
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"       %s -c <subsystem>\n"
+		"Options:\n"
+		"	-s <path>	Listen on given socket (default: %s)\n"
+		"	-w <ms>		Coalesce identical events within given window,\n"
+		"			0 disables (default: %d)\n"
+		"	-c <subsystem>	Pass the current environment as event to the daemon\n"
+		"	-v		Log handler list reloads and worker starts\n"
+		"\n", prog, prog, HOTPLUGD_SOCK, coalesce_ms);
+
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct pollfd pfd[2 + MAX_CONNS + MAX_SUBSYS];
+	struct subsys *owner[MAX_SUBSYS];
+	const char *path = HOTPLUGD_SOCK;
+	const char *client = NULL;
+	int i, n, n_conn, ch;
+
+	while ((ch = getopt(argc, argv, "s:w:c:v")) != -1) {
+		switch (ch) {
+		case 's':
+			path = optarg;
+			break;
+		case 'w':
+			coalesce_ms = atoi(optarg);
+			break;
+		case 'c':
+			client = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (client)
+		return run_client(path, client);
+
+	openlog("hotplugd", LOG_PID | LOG_PERROR, LOG_DAEMON);
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, handle_signal);
+	signal(SIGTERM, handle_signal);
+	signal(SIGUSR1, handle_signal);
+
+	if ((listen_fd = listen_sock(path)) < 0) {
+		msg(LOG_ERR, "unable to listen on %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	if ((inotify_fd = inotify_init()) >= 0) {
+		set_nonblock(inotify_fd);
+		inotify_add_watch(inotify_fd, HOTPLUG_DIR, INOTIFY_MASK);
+	} else {
+		/* without inotify we can not cache the handler lists */
+		msg(LOG_WARNING, "inotify unavailable, not caching handlers\n");
+	}
+
+	lib_funcs_load(HOTPLUG_FUNCS);
+	lib_funcs_load(HOTPLUG_UCI);
+
+	for (i = 0; i < MAX_CONNS; i++)
+		conns[i].fd = -1;
+
+	while (!do_exit) {
+		if (do_stats) {
+			msg(LOG_INFO, "%lu events run, %lu coalesced\n",
+			    events_run, events_coalesced);
+			do_stats = 0;
+		}
+
+		if (inotify_fd < 0)
+			for (i = 0; i < n_subsystems; i++)
+				if (!subsystems[i]->busy)
+					scripts_free(subsystems[i]);
+
+		n = 0;
+
+		pfd[n].fd = listen_fd;
+		pfd[n++].events = POLLIN;
+
+		pfd[n].fd = inotify_fd;
+		pfd[n++].events = POLLIN;
+
+		for (i = 0; i < MAX_CONNS; i++) {
+			pfd[n].fd = conns[i].fd;
+			pfd[n++].events = POLLIN;
+		}
+
+		n_conn = n;
+
+		for (i = 0; i < n_subsystems; i++) {
+			owner[i] = subsystems[i];
+			pfd[n].fd = subsystems[i]->pid ? subsystems[i]->ack_fd : -1;
+			pfd[n++].events = POLLIN;
+		}
+
+		if (poll(pfd, n, -1) < 0)
+			continue;
+
+		if (pfd[1].revents)
+			scripts_invalidate();
+
+		for (i = n_conn; i < n; i++)
+			if (pfd[i].revents)
+				subsys_ack(owner[i - n_conn]);
+
+		for (i = 0; i < MAX_CONNS; i++)
+			if (pfd[2 + i].revents && conns[i].fd >= 0)
+				conn_read(&conns[i]);
+
+		if (pfd[0].revents)
+			conn_accept();
+	}
+
+	for (i = 0; i < n_subsystems; i++)
+		worker_stop(subsystems[i]);
+
+	unlink(path);
+
+	return 0;
+}
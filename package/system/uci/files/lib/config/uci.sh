@@ -41,6 +41,7 @@ uci_load() {
 	RET="$?"
 	[ "$RET" != 0 -o -z "$DATA" ] || eval "$DATA"
 	unset DATA
+	config_list_join
 
 	${CONFIG_SECTION:+config_cb}
 	return "$RET"
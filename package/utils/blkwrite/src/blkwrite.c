@@ -0,0 +1,242 @@
+/*
+ * blkwrite - write an image to a block device, skipping unchanged data
+ *
+ *   Copyright (C) 2015 OpenWrt.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * The image is read from stdin in chunks, each chunk is compared with what
+ * is on the device at its offset and only written when it differs. Chunks
+ * of zeros are cleared with BLKZEROOUT, which lets the device discard them
+ * where it can. Data is flushed once at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#define DEFAULT_CHUNK	(1024 * 1024)
+
+static int quiet;
+
+static uint64_t bytes_written;
+static uint64_t bytes_zeroed;
+static uint64_t bytes_skipped;
+
+static int is_zero(const uint8_t *buf, size_t len)
+{
+	const unsigned long *p = (const unsigned long *)buf;
+	size_t i;
+
+	/* chunks are allocated aligned and a multiple of the word size */
+	for (i = 0; i < len / sizeof(*p); i++)
+		if (p[i])
+			return 0;
+
+	for (i = i * sizeof(*p); i < len; i++)
+		if (buf[i])
+			return 0;
+
+	return 1;
+}
+
+/* seq: read from the current file position instead of at ofs */
+static ssize_t read_full(int fd, uint8_t *buf, size_t len, int seq, off_t ofs)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		if (seq)
+			n = read(fd, buf + done, len - done);
+		else
+			n = pread(fd, buf + done, len - done, ofs + done);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		if (!n)
+			break;
+
+		done += n;
+	}
+
+	return done;
+}
+
+static int write_full(int fd, const uint8_t *buf, size_t len, off_t ofs)
+{
+	ssize_t n;
+
+	while (len) {
+		n = pwrite(fd, buf, len, ofs);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+
+		buf += n;
+		ofs += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int zero_range(int fd, int blkdev, size_t blksize, const uint8_t *zero,
+		      size_t len, off_t ofs)
+{
+	uint64_t range[2] = { ofs, len };
+
+	if (blkdev && !(ofs % blksize) && !(len % blksize) &&
+	    !ioctl(fd, BLKZEROOUT, range))
+		return 0;
+
+	return write_full(fd, zero, len, ofs);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-b <size>] [-q] <device>\n"
+		"\n"
+		"Write the image read from stdin to <device>, skipping the\n"
+		"chunks which already match the device contents.\n"
+		"\n"
+		"  -b <size>  chunk size in KiB (default: %d)\n"
+		"  -q         do not print statistics\n",
+		prog, DEFAULT_CHUNK / 1024);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t *img, *cur, *zero;
+	size_t chunk = DEFAULT_CHUNK;
+	int blksize = 512;
+	uint64_t size;
+	struct stat st;
+	off_t ofs = 0;
+	ssize_t len, n;
+	int fd, ch, blkdev;
+	int ret = 1;
+
+	while ((ch = getopt(argc, argv, "b:q")) != -1) {
+		switch (ch) {
+		case 'b':
+			chunk = strtoul(optarg, NULL, 0) * 1024;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1 || !chunk)
+		usage(argv[0]);
+
+	fd = open(argv[optind], O_RDWR);
+	if (fd < 0 || fstat(fd, &st)) {
+		fprintf(stderr, "Failed to open %s: %s\n", argv[optind],
+			strerror(errno));
+		return 1;
+	}
+
+	/* regular files are accepted as well, which helps testing */
+	blkdev = S_ISBLK(st.st_mode);
+	if (blkdev) {
+		if (ioctl(fd, BLKGETSIZE64, &size) ||
+		    ioctl(fd, BLKSSZGET, &blksize)) {
+			fprintf(stderr, "Failed to get the size of %s: %s\n",
+				argv[optind], strerror(errno));
+			goto out;
+		}
+	} else {
+		size = UINT64_MAX;
+	}
+
+	if (chunk % blksize)
+		chunk += blksize - chunk % blksize;
+
+	if (posix_memalign((void **)&img, 4096, chunk) ||
+	    posix_memalign((void **)&cur, 4096, chunk) ||
+	    !(zero = calloc(1, chunk))) {
+		fprintf(stderr, "Out of memory\n");
+		goto out;
+	}
+
+	while ((len = read_full(STDIN_FILENO, img, chunk, 1, 0)) > 0) {
+		if ((uint64_t)ofs + len > size) {
+			fprintf(stderr, "Image does not fit on %s\n",
+				argv[optind]);
+			goto out;
+		}
+
+		n = read_full(fd, cur, len, 0, ofs);
+		if (n < 0) {
+			fprintf(stderr, "Failed to read %s: %s\n",
+				argv[optind], strerror(errno));
+			goto out;
+		}
+
+		if (n == len && !memcmp(img, cur, len)) {
+			bytes_skipped += len;
+		} else if (is_zero(img, len)) {
+			if (zero_range(fd, blkdev, blksize, zero, len, ofs))
+				goto write_err;
+			bytes_zeroed += len;
+		} else {
+			if (write_full(fd, img, len, ofs))
+				goto write_err;
+			bytes_written += len;
+		}
+
+		ofs += len;
+	}
+
+	if (len < 0) {
+		fprintf(stderr, "Failed to read the image: %s\n",
+			strerror(errno));
+		goto out;
+	}
+
+	if (fsync(fd))
+		goto write_err;
+
+	if (!quiet)
+		fprintf(stderr, "%llu bytes written, %llu zeroed, "
+			"%llu unchanged\n",
+			(unsigned long long)bytes_written,
+			(unsigned long long)bytes_zeroed,
+			(unsigned long long)bytes_skipped);
+
+	ret = 0;
+	goto out;
+
+write_err:
+	fprintf(stderr, "Failed to write %s at offset %llu: %s\n",
+		argv[optind], (unsigned long long)ofs, strerror(errno));
+out:
+	close(fd);
+	return ret;
+}
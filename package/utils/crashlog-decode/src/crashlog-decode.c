@@ -0,0 +1,276 @@
+/*
+ * crashlog-decode - print the crashlog event rings of the previous boot
+ *
+ *   Copyright (C) 2015 OpenWrt.org
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2
+ * as published by the Free Software Foundation
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * The kernel copies the event area it finds in reserved memory at boot and
+ * exposes it as /sys/kernel/debug/crashlog_events. The layout below must
+ * match include/linux/crashlog.h; the data is decoded on the device that
+ * wrote it, so fields are in native byte order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#define CRASHLOG_EVENT_MAGIC	0xa1ee7e57
+#define CRASHLOG_EVENT_VERSION	1
+#define CRASHLOG_EVENT_TYPES	64
+#define CRASHLOG_EVENT_NAMELEN	16
+
+#define CRASHLOG_EVENT_F_DROPS	(1 << 0)
+
+#define DEFAULT_INPUT	"/sys/kernel/debug/crashlog_events"
+
+enum {
+	EV_NONE,
+	EV_SOFTIRQ,
+	EV_NAPI,
+	EV_DROP,
+	EV_OOM,
+};
+
+struct crashlog_event {
+	uint64_t time;
+	uint32_t type;
+	uint32_t arg[3];
+};
+
+struct crashlog_ring {
+	uint32_t head;
+	uint32_t cpu;
+	struct crashlog_event ev[];
+};
+
+struct crashlog_event_area {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t nr_rings;
+	uint32_t ring_size;
+	uint32_t threshold;
+	uint32_t flags;
+	uint32_t reserved;
+	uint64_t boot_time;
+	char names[CRASHLOG_EVENT_TYPES][CRASHLOG_EVENT_NAMELEN];
+};
+
+static const char * const softirq_names[] = {
+	"HI", "TIMER", "NET_TX", "NET_RX", "BLOCK",
+	"BLOCK_IOPOLL", "TASKLET", "SCHED", "HRTIMER", "RCU",
+};
+
+struct ksym {
+	uint64_t addr;
+	char *name;
+};
+
+static struct ksym *ksyms;
+static size_t n_ksyms;
+
+static int ksym_cmp(const void *a, const void *b)
+{
+	const struct ksym *ka = a, *kb = b;
+
+	if (ka->addr == kb->addr)
+		return 0;
+
+	return ka->addr < kb->addr ? -1 : 1;
+}
+
+static void load_kallsyms(void)
+{
+	char line[256], name[128], type;
+	unsigned long long addr;
+	size_t size = 0;
+	FILE *f;
+
+	f = fopen("/proc/kallsyms", "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%llx %c %127s", &addr, &type, name) != 3)
+			continue;
+
+		/* addresses are hidden from unprivileged readers */
+		if (!addr || (type != 't' && type != 'T'))
+			continue;
+
+		if (n_ksyms == size) {
+			size = size ? size * 2 : 4096;
+			ksyms = realloc(ksyms, size * sizeof(*ksyms));
+			if (!ksyms) {
+				n_ksyms = 0;
+				break;
+			}
+		}
+
+		ksyms[n_ksyms].addr = addr;
+		ksyms[n_ksyms].name = strdup(name);
+		n_ksyms++;
+	}
+	fclose(f);
+
+	qsort(ksyms, n_ksyms, sizeof(*ksyms), ksym_cmp);
+}
+
+static void print_location(uint64_t addr)
+{
+	size_t lo = 0, hi = n_ksyms;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (ksyms[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo)
+		printf("%s+0x%llx", ksyms[lo - 1].name,
+		       (unsigned long long)(addr - ksyms[lo - 1].addr));
+	else
+		printf("0x%llx", (unsigned long long)addr);
+}
+
+static void print_event(const struct crashlog_event_area *area,
+			const struct crashlog_event *ev)
+{
+	const uint32_t *arg = ev->arg;
+
+	printf("[%5llu.%06llu] ", (unsigned long long)(ev->time / 1000000000),
+	       (unsigned long long)(ev->time % 1000000000 / 1000));
+
+	switch (ev->type) {
+	case EV_SOFTIRQ:
+		if (arg[0] < sizeof(softirq_names) / sizeof(softirq_names[0]))
+			printf("softirq %s", softirq_names[arg[0]]);
+		else
+			printf("softirq %u", arg[0]);
+		printf(" took %u us\n", arg[1] / 1000);
+		break;
+	case EV_NAPI:
+		printf("napi ifindex %u work %u took %u us\n",
+		       arg[0], arg[1], arg[2] / 1000);
+		break;
+	case EV_DROP:
+		printf("drop ");
+		print_location(((uint64_t)arg[2] << 32) | arg[0]);
+		if (arg[1] != 1)
+			printf(" x%u", arg[1]);
+		printf("\n");
+		break;
+	case EV_OOM:
+		printf("oom pid %u free %u pages\n", arg[0], arg[1]);
+		break;
+	default:
+		if (ev->type < CRASHLOG_EVENT_TYPES && area->names[ev->type][0])
+			printf("%.*s", CRASHLOG_EVENT_NAMELEN, area->names[ev->type]);
+		else
+			printf("type %u", ev->type);
+		printf(" %08x %08x %08x\n", arg[0], arg[1], arg[2]);
+		break;
+	}
+}
+
+static int decode(const char *buf, size_t len)
+{
+	const struct crashlog_event_area *area = (const void *)buf;
+	const struct crashlog_ring *ring;
+	size_t ring_bytes;
+	uint32_t i, n;
+	int cpu;
+
+	if (len < sizeof(*area) || area->magic != CRASHLOG_EVENT_MAGIC) {
+		fprintf(stderr, "No crashlog event data found\n");
+		return -1;
+	}
+
+	if (area->version != CRASHLOG_EVENT_VERSION) {
+		fprintf(stderr, "Unsupported crashlog event version %u\n",
+			area->version);
+		return -1;
+	}
+
+	ring_bytes = sizeof(*ring) + area->ring_size * sizeof(ring->ev[0]);
+	if (!area->ring_size || (area->ring_size & (area->ring_size - 1)) ||
+	    sizeof(*area) + area->nr_rings * ring_bytes > len) {
+		fprintf(stderr, "Corrupted crashlog event header\n");
+		return -1;
+	}
+
+	printf("Events of boot at %llu, threshold %u us\n",
+	       (unsigned long long)area->boot_time, area->threshold / 1000);
+
+	/* drop recording costs a branch per freed skb, so it is opt-in */
+	if (!(area->flags & CRASHLOG_EVENT_F_DROPS))
+		printf("Packet drops were not recorded (crashlog.drops=0)\n");
+
+	for (cpu = 0; cpu < area->nr_rings; cpu++) {
+		ring = (const void *)(buf + sizeof(*area) + cpu * ring_bytes);
+		if (!ring->head)
+			continue;
+
+		n = ring->head;
+		if (n > area->ring_size)
+			n = area->ring_size;
+
+		printf("\nCPU %u: %u events", ring->cpu, ring->head);
+		if (n < ring->head)
+			printf(", last %u kept", n);
+		printf("\n");
+
+		for (i = ring->head - n; i != ring->head; i++)
+			print_event(area, &ring->ev[i & (area->ring_size - 1)]);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = argc > 1 ? argv[1] : DEFAULT_INPUT;
+	size_t len = 0, size = 0;
+	char *buf = NULL;
+	FILE *f;
+	int ret;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	/* debugfs blobs do not report their size, read until EOF */
+	do {
+		if (len == size) {
+			size = size ? size * 2 : 65536;
+			buf = realloc(buf, size);
+			if (!buf) {
+				fprintf(stderr, "Out of memory\n");
+				return 1;
+			}
+		}
+		ret = fread(buf + len, 1, size - len, f);
+		len += ret;
+	} while (ret > 0);
+	fclose(f);
+
+	load_kallsyms();
+
+	return decode(buf, len) ? 1 : 0;
+}
@@ -1656,46 +1656,22 @@ static const int small_prime[] =
 };
 
 /*
- * Miller-Rabin primality test  (HAC 4.24)
+ * Miller-Rabin test of an odd X > 3  (HAC 4.24)
  */
-int mpi_is_prime( mpi *X, int (*f_rng)(void *), void *p_rng )
+static int mpi_miller_rabin( mpi *X, int (*f_rng)(void *), void *p_rng )
 {
-    int ret, i, j, n, s, xs;
+    int ret, i, j, n, s;
     mpi W, R, T, A, RR;
     unsigned char *p;
 
-    if( mpi_cmp_int( X, 0 ) == 0 )
-        return( 0 );
-
     mpi_init( &W, &R, &T, &A, &RR, NULL );
 
-    xs = X->s; X->s = 1;
-
-    /*
-     * test trivial factors first
-     */
-    if( ( X->p[0] & 1 ) == 0 )
-        return( POLARSSL_ERR_MPI_NOT_ACCEPTABLE );
-
-    for( i = 0; small_prime[i] > 0; i++ )
-    {
-        t_int r;
-
-        if( mpi_cmp_int( X, small_prime[i] ) <= 0 )
-            return( 0 );
-
-        MPI_CHK( mpi_mod_int( &r, X, small_prime[i] ) );
-
-        if( r == 0 )
-            return( POLARSSL_ERR_MPI_NOT_ACCEPTABLE );
-    }
-
     /*
      * W = |X| - 1
      * R = W >> lsb( W )
      */
-    s = mpi_lsb( &W );
     MPI_CHK( mpi_sub_int( &W, X, 1 ) );
+    s = mpi_lsb( &W );
     MPI_CHK( mpi_copy( &R, &W ) );
     MPI_CHK( mpi_shift_r( &R, s ) );
 
@@ -1757,11 +1733,134 @@ int mpi_is_prime( mpi *X, int (*f_rng)(void *), void *p_rng )
         }
     }
 
+cleanup:
+
+    mpi_free( &RR, &A, &T, &R, &W, NULL );
+
+    return( ret );
+}
+
+/*
+ * Miller-Rabin primality test, after trial division
+ */
+int mpi_is_prime( mpi *X, int (*f_rng)(void *), void *p_rng )
+{
+    int ret, i, xs;
+
+    if( mpi_cmp_int( X, 0 ) == 0 )
+        return( 0 );
+
+    xs = X->s; X->s = 1;
+
+    /*
+     * test trivial factors first
+     */
+    if( ( X->p[0] & 1 ) == 0 )
+    {
+        ret = POLARSSL_ERR_MPI_NOT_ACCEPTABLE;
+        goto cleanup;
+    }
+
+    for( i = 0; small_prime[i] > 0; i++ )
+    {
+        t_int r;
+
+        if( mpi_cmp_int( X, small_prime[i] ) <= 0 )
+        {
+            ret = 0;
+            goto cleanup;
+        }
+
+        MPI_CHK( mpi_mod_int( &r, X, small_prime[i] ) );
+
+        if( r == 0 )
+        {
+            ret = POLARSSL_ERR_MPI_NOT_ACCEPTABLE;
+            goto cleanup;
+        }
+    }
+
+    ret = mpi_miller_rabin( X, f_rng, p_rng );
+
 cleanup:
 
     X->s = xs;
 
-    mpi_free( &RR, &A, &T, &R, &W, NULL );
+    return( ret );
+}
+
+/*
+ * Candidates are sieved with all odd primes below PRIME_SIEVE_LIMIT, one
+ * window of PRIME_SIEVE_SIZE odd numbers at a time. The window covers a
+ * few times the average gap between primes of RSA size.
+ */
+#define PRIME_SIEVE_LIMIT   32768
+#define PRIME_SIEVE_SIZE    2048
+
+/* one bit per odd number, set if composite */
+static unsigned char sieve_composite[PRIME_SIEVE_LIMIT / 16];
+
+#define SIEVE_IS_COMPOSITE(i) \
+    ( sieve_composite[(i) >> 4] & ( 1 << ( ( (i) >> 1 ) & 7 ) ) )
+
+static void mpi_sieve_init( void )
+{
+    unsigned int i, j;
+
+    /* 1 is not prime, its bit doubles as "initialized" flag */
+    if( sieve_composite[0] & 1 )
+        return;
+
+    sieve_composite[0] |= 1;
+
+    for( i = 3; i * i < PRIME_SIEVE_LIMIT; i += 2 )
+    {
+        if( SIEVE_IS_COMPOSITE( i ) )
+            continue;
+
+        for( j = i * i; j < PRIME_SIEVE_LIMIT; j += 2 * i )
+            sieve_composite[j >> 4] |= 1 << ( ( j >> 1 ) & 7 );
+    }
+}
+
+/*
+ * Mark the k for which B + 2k has a small factor. With dh_flag, also
+ * mark those for which (B + 2k - 1) / 2 has one or is even.
+ */
+static int mpi_sieve( mpi *B, int dh_flag, unsigned char *sieve )
+{
+    int ret = 0;
+    unsigned int p, k, half;
+    t_int r;
+
+    memset( sieve, 0, PRIME_SIEVE_SIZE );
+
+    /* B = 3 mod 4, so (B + 2k - 1) / 2 is even for odd k */
+    if( dh_flag )
+        for( k = 1; k < PRIME_SIEVE_SIZE; k += 2 )
+            sieve[k] = 1;
+
+    for( p = 3; p < PRIME_SIEVE_LIMIT; p += 2 )
+    {
+        if( SIEVE_IS_COMPOSITE( p ) )
+            continue;
+
+        MPI_CHK( mpi_mod_int( &r, B, p ) );
+
+        /*
+         * B + 2k = 0 (mod p) for k = -r / 2 (mod p)
+         */
+        half = ( p + 1 ) >> 1;
+        for( k = ( p - r ) % p * half % p; k < PRIME_SIEVE_SIZE; k += p )
+            sieve[k] = 1;
+
+        if( dh_flag )
+            for( k = ( p + 1 - r ) % p * half % p; k < PRIME_SIEVE_SIZE;
+                 k += p )
+                sieve[k] = 1;
+    }
+
+cleanup:
 
     return( ret );
 }
@@ -1773,13 +1872,13 @@ int mpi_gen_prime( mpi *X, int nbits, int dh_flag,
                    int (*f_rng)(void *), void *p_rng )
 {
     int ret, k, n;
-    unsigned char *p;
-    mpi Y;
+    unsigned char *p, *sieve = NULL;
+    mpi Y, B;
 
     if( nbits < 3 )
         return( POLARSSL_ERR_MPI_BAD_INPUT_DATA );
 
-    mpi_init( &Y, NULL );
+    mpi_init( &Y, &B, NULL );
 
     n = BITS_TO_LIMBS( nbits );
 
@@ -1794,8 +1893,59 @@ int mpi_gen_prime( mpi *X, int nbits, int dh_flag,
     if( k < nbits ) MPI_CHK( mpi_shift_l( X, nbits - k ) );
     if( k > nbits ) MPI_CHK( mpi_shift_r( X, k - nbits ) );
 
+    /*
+     * also set the second highest bit, so that the product of two such
+     * primes always has 2 * nbits bits and RSA key generation does not
+     * have to start over
+     */
+    X->p[( nbits - 2 ) / biL] |= (t_int) 1 << ( ( nbits - 2 ) % biL );
     X->p[0] |= 3;
 
+    /*
+     * large candidates: sieve a window starting at B = X, then run
+     * Miller-Rabin on the survivors only
+     */
+    if( nbits > 32 )
+    {
+        mpi_sieve_init();
+
+        if( ( sieve = (unsigned char *) malloc( PRIME_SIEVE_SIZE ) ) == NULL )
+        {
+            ret = 1;
+            goto cleanup;
+        }
+
+        MPI_CHK( mpi_copy( &B, X ) );
+
+        while( 1 )
+        {
+            MPI_CHK( mpi_sieve( &B, dh_flag, sieve ) );
+
+            for( k = 0; k < PRIME_SIEVE_SIZE; k++ )
+            {
+                if( sieve[k] )
+                    continue;
+
+                MPI_CHK( mpi_add_int( X, &B, 2 * k ) );
+
+                ret = mpi_miller_rabin( X, f_rng, p_rng );
+
+                if( ret == 0 && dh_flag )
+                {
+                    MPI_CHK( mpi_copy( &Y, X ) );
+                    MPI_CHK( mpi_shift_r( &Y, 1 ) );
+
+                    ret = mpi_miller_rabin( &Y, f_rng, p_rng );
+                }
+
+                if( ret != POLARSSL_ERR_MPI_NOT_ACCEPTABLE )
+                    goto cleanup;
+            }
+
+            MPI_CHK( mpi_add_int( &B, &B, 2 * PRIME_SIEVE_SIZE ) );
+        }
+    }
+
     if( dh_flag == 0 )
     {
         while( ( ret = mpi_is_prime( X, f_rng, p_rng ) ) != 0 )
@@ -1833,7 +1983,9 @@ int mpi_gen_prime( mpi *X, int nbits, int dh_flag,
 
 cleanup:
 
-    mpi_free( &Y, NULL );
+    free( sieve );
+
+    mpi_free( &B, &Y, NULL );
 
     return( ret );
 }
@@ -0,0 +1,272 @@
+/*
+ *  Elliptic curve key generation, NIST P-256 only
+ *
+ *  Copyright (C) 2015  OpenWrt.org
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License, version 2.1 as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+/*
+ *  FIPS 186-3, appendix D.1.2.3 (curve P-256)
+ *  SEC 1, section 3.2.1 (key pair generation)
+ *
+ *  http://www.hyperelliptic.org/EFD/g1p/auto-shortw-jacobian-3.html
+ */
+
+#include "polarssl/config.h"
+
+#if defined(POLARSSL_ECP_C)
+
+#include "polarssl/ecp.h"
+
+#include <string.h>
+
+static const char p256_p[]  =
+    "FFFFFFFF00000001000000000000000000000000FFFFFFFFFFFFFFFFFFFFFFFF";
+static const char p256_n[]  =
+    "FFFFFFFF00000000FFFFFFFFFFFFFFFFBCE6FAADA7179E84F3B9CAC2FC632551";
+static const char p256_gx[] =
+    "6B17D1F2E12C4247F8BCE6E563A440F277037D812DEB33A0F4A13945D898C296";
+static const char p256_gy[] =
+    "4FE342E2FE1A7F9B8EE7EB4A7C0F9E162BCE33576B315ECECBB6406837BF51F5";
+
+/*
+ * Point in Jacobian coordinates, (X / Z^2, Y / Z^3); Z == 0 is the
+ * point at infinity
+ */
+typedef struct
+{
+    mpi X, Y, Z;
+}
+ecp_point;
+
+#define MOD_MUL( X, A, B )                                  \
+    MPI_CHK( mpi_mul_mpi( X, A, B ) );                      \
+    MPI_CHK( mpi_mod_mpi( X, X, P ) )
+
+#define MOD_ADD( X, A, B )                                  \
+    MPI_CHK( mpi_add_mpi( X, A, B ) );                      \
+    if( mpi_cmp_mpi( X, P ) >= 0 )                          \
+        MPI_CHK( mpi_sub_abs( X, X, P ) )
+
+#define MOD_SUB( X, A, B )                                  \
+    MPI_CHK( mpi_sub_mpi( X, A, B ) );                      \
+    if( mpi_cmp_int( X, 0 ) < 0 )                           \
+        MPI_CHK( mpi_add_mpi( X, X, P ) )
+
+/*
+ * R = 2 R, "dbl-2001-b" for a = -3
+ */
+static int ecp_double( ecp_point *R, mpi *P )
+{
+    int ret;
+    mpi delta, gamma, beta, alpha, T;
+
+    if( mpi_cmp_int( &R->Z, 0 ) == 0 )
+        return( 0 );
+
+    mpi_init( &delta, &gamma, &beta, &alpha, &T, NULL );
+
+    MOD_MUL( &delta, &R->Z, &R->Z );
+    MOD_MUL( &gamma, &R->Y, &R->Y );
+    MOD_MUL( &beta,  &R->X, &gamma );
+
+    /* alpha = 3 (X - delta) (X + delta) */
+    MOD_SUB( &T, &R->X, &delta );
+    MOD_ADD( &alpha, &R->X, &delta );
+    MOD_MUL( &alpha, &alpha, &T );
+    MOD_ADD( &T, &alpha, &alpha );
+    MOD_ADD( &alpha, &alpha, &T );
+
+    /* Z3 = (Y + Z)^2 - gamma - delta */
+    MOD_ADD( &T, &R->Y, &R->Z );
+    MOD_MUL( &R->Z, &T, &T );
+    MOD_SUB( &R->Z, &R->Z, &gamma );
+    MOD_SUB( &R->Z, &R->Z, &delta );
+
+    /* X3 = alpha^2 - 8 beta */
+    MPI_CHK( mpi_shift_l( &beta, 2 ) );
+    MPI_CHK( mpi_mod_mpi( &beta, &beta, P ) );
+    MOD_MUL( &R->X, &alpha, &alpha );
+    MOD_SUB( &R->X, &R->X, &beta );
+    MOD_SUB( &R->X, &R->X, &beta );
+
+    /* Y3 = alpha (4 beta - X3) - 8 gamma^2 */
+    MOD_SUB( &T, &beta, &R->X );
+    MOD_MUL( &R->Y, &alpha, &T );
+    MOD_MUL( &T, &gamma, &gamma );
+    MPI_CHK( mpi_shift_l( &T, 3 ) );
+    MPI_CHK( mpi_mod_mpi( &T, &T, P ) );
+    MOD_SUB( &R->Y, &R->Y, &T );
+
+cleanup:
+
+    mpi_free( &T, &alpha, &beta, &gamma, &delta, NULL );
+
+    return( ret );
+}
+
+/*
+ * R = R + (x, y), "madd-2004-hmv"
+ */
+static int ecp_add_affine( ecp_point *R, mpi *x, mpi *y, mpi *P )
+{
+    int ret;
+    mpi Z1Z1, U2, S2, H, r, HH, HHH, V;
+
+    mpi_init( &Z1Z1, &U2, &S2, &H, &r, &HH, &HHH, &V, NULL );
+
+    if( mpi_cmp_int( &R->Z, 0 ) == 0 )
+    {
+        MPI_CHK( mpi_copy( &R->X, x ) );
+        MPI_CHK( mpi_copy( &R->Y, y ) );
+        MPI_CHK( mpi_lset( &R->Z, 1 ) );
+        goto cleanup;
+    }
+
+    MOD_MUL( &Z1Z1, &R->Z, &R->Z );
+    MOD_MUL( &U2, x, &Z1Z1 );
+    MOD_MUL( &S2, y, &R->Z );
+    MOD_MUL( &S2, &S2, &Z1Z1 );
+    MOD_SUB( &H, &U2, &R->X );
+    MOD_SUB( &r, &S2, &R->Y );
+
+    if( mpi_cmp_int( &H, 0 ) == 0 )
+    {
+        /* same x: either R == (x, y) or R == -(x, y) */
+        if( mpi_cmp_int( &r, 0 ) == 0 )
+            ret = ecp_double( R, P );
+        else
+            ret = mpi_lset( &R->Z, 0 );
+
+        goto cleanup;
+    }
+
+    MOD_MUL( &HH, &H, &H );
+    MOD_MUL( &HHH, &H, &HH );
+    MOD_MUL( &V, &R->X, &HH );
+
+    /* Z3 = Z1 H */
+    MOD_MUL( &R->Z, &R->Z, &H );
+
+    /* X3 = r^2 - HHH - 2 V */
+    MOD_MUL( &R->X, &r, &r );
+    MOD_SUB( &R->X, &R->X, &HHH );
+    MOD_SUB( &R->X, &R->X, &V );
+    MOD_SUB( &R->X, &R->X, &V );
+
+    /* Y3 = r (V - X3) - Y1 HHH */
+    MOD_MUL( &HHH, &HHH, &R->Y );
+    MOD_SUB( &V, &V, &R->X );
+    MOD_MUL( &R->Y, &r, &V );
+    MOD_SUB( &R->Y, &R->Y, &HHH );
+
+cleanup:
+
+    mpi_free( &V, &HHH, &HH, &r, &H, &S2, &U2, &Z1Z1, NULL );
+
+    return( ret );
+}
+
+/*
+ * Initialize a key pair
+ */
+void ecp_init( ecp_keypair *key )
+{
+    memset( key, 0, sizeof( ecp_keypair ) );
+}
+
+/*
+ * Generate a key pair: 0 < d < n, Q = d G  (SEC 1, 3.2.1)
+ */
+int ecp_gen_key( ecp_keypair *key, int (*f_rng)(void *), void *p_rng )
+{
+    int ret, i;
+    unsigned char buf[ECP_P256_LEN];
+    mpi P, N, Gx, Gy, Zi, T;
+    ecp_point R;
+
+    mpi_init( &P, &N, &Gx, &Gy, &Zi, &T, &R.X, &R.Y, &R.Z, NULL );
+
+    MPI_CHK( mpi_read_string( &P,  16, (char *) p256_p  ) );
+    MPI_CHK( mpi_read_string( &N,  16, (char *) p256_n  ) );
+    MPI_CHK( mpi_read_string( &Gx, 16, (char *) p256_gx ) );
+    MPI_CHK( mpi_read_string( &Gy, 16, (char *) p256_gy ) );
+
+    /*
+     * rejection sampling keeps d uniform, n is close to 2^256
+     */
+    do
+    {
+        for( i = 0; i < ECP_P256_LEN; i++ )
+            buf[i] = (unsigned char) f_rng( p_rng );
+
+        MPI_CHK( mpi_read_binary( &key->d, buf, ECP_P256_LEN ) );
+    }
+    while( mpi_cmp_int( &key->d, 0 ) == 0 ||
+           mpi_cmp_mpi( &key->d, &N ) >= 0 );
+
+    memset( buf, 0, sizeof( buf ) );
+
+    /*
+     * left-to-right double and add
+     */
+    MPI_CHK( mpi_lset( &R.X, 1 ) );
+    MPI_CHK( mpi_lset( &R.Y, 1 ) );
+    MPI_CHK( mpi_lset( &R.Z, 0 ) );
+
+    for( i = mpi_msb( &key->d ) - 1; i >= 0; i-- )
+    {
+        MPI_CHK( ecp_double( &R, &P ) );
+
+        if( ( key->d.p[i / ( 8 * sizeof( t_int ) )] >>
+              ( i % ( 8 * sizeof( t_int ) ) ) ) & 1 )
+            MPI_CHK( ecp_add_affine( &R, &Gx, &Gy, &P ) );
+    }
+
+    /*
+     * Q = (X / Z^2, Y / Z^3)
+     */
+    MPI_CHK( mpi_inv_mod( &Zi, &R.Z, &P ) );
+    MPI_CHK( mpi_mul_mpi( &T, &Zi, &Zi ) );
+    MPI_CHK( mpi_mod_mpi( &T, &T, &P ) );
+    MPI_CHK( mpi_mul_mpi( &key->Qx, &R.X, &T ) );
+    MPI_CHK( mpi_mod_mpi( &key->Qx, &key->Qx, &P ) );
+    MPI_CHK( mpi_mul_mpi( &T, &T, &Zi ) );
+    MPI_CHK( mpi_mod_mpi( &T, &T, &P ) );
+    MPI_CHK( mpi_mul_mpi( &key->Qy, &R.Y, &T ) );
+    MPI_CHK( mpi_mod_mpi( &key->Qy, &key->Qy, &P ) );
+
+cleanup:
+
+    mpi_free( &R.Z, &R.Y, &R.X, &T, &Zi, &Gy, &Gx, &N, &P, NULL );
+
+    if( ret != 0 )
+    {
+        ecp_free( key );
+        return( POLARSSL_ERR_ECP_KEY_GEN_FAILED | ret );
+    }
+
+    return( 0 );
+}
+
+/*
+ * Free the components of a key pair
+ */
+void ecp_free( ecp_keypair *key )
+{
+    mpi_free( &key->Qy, &key->Qx, &key->d, NULL );
+}
+
+#endif
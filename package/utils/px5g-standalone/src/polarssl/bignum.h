@@ -64,7 +64,8 @@ typedef unsigned long  t_dbl;
   #else
     #if defined(__amd64__) || defined(__x86_64__)    || \
         defined(__ppc64__) || defined(__powerpc64__) || \
-        defined(__ia64__)  || defined(__alpha__)
+        defined(__ia64__)  || defined(__alpha__)    || \
+        defined(__LP64__)
     typedef unsigned int t_dbl __attribute__((mode(TI)));
     #else
     typedef unsigned long long t_dbl;
@@ -56,9 +56,9 @@
  */
 
 /*
- * Uncomment if the compiler supports long long.
-#define POLARSSL_HAVE_LONGLONG
+ * Comment if the compiler does not support long long.
  */
+#define POLARSSL_HAVE_LONGLONG
 
 
 /*
@@ -180,6 +180,14 @@
  */
 #define POLARSSL_DHM_C
 
+/*
+ * Module:  library/ecp.c
+ * Caller:
+ *
+ * This module enables P-256 key pair generation.
+ */
+#define POLARSSL_ECP_C
+
 /*
  * Module:  library/havege.c
  * Caller:
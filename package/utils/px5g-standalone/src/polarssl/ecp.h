@@ -0,0 +1,72 @@
+/**
+ * \file ecp.h
+ *
+ *  Copyright (C) 2015  OpenWrt.org
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License, version 2.1 as published by the Free Software Foundation.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA  02110-1301  USA
+ */
+#ifndef POLARSSL_ECP_H
+#define POLARSSL_ECP_H
+
+#include "polarssl/bignum.h"
+
+#define POLARSSL_ERR_ECP_KEY_GEN_FAILED                    -0x0500
+
+/* size of a P-256 coordinate in bytes */
+#define ECP_P256_LEN    32
+
+/**
+ * \brief          P-256 (secp256r1) key pair
+ */
+typedef struct
+{
+    mpi d;                      /*!<  private value     */
+    mpi Qx;                     /*!<  public point, x   */
+    mpi Qy;                     /*!<  public point, y   */
+}
+ecp_keypair;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \brief          Initialize a key pair
+ *
+ * \param key      key pair to be initialized
+ */
+void ecp_init( ecp_keypair *key );
+
+/**
+ * \brief          Generate a P-256 key pair
+ *
+ * \param key      key pair to be filled
+ * \param f_rng    RNG function
+ * \param p_rng    RNG parameter
+ *
+ * \return         0 if successful, or an POLARSSL_ERR_ECP_XXX error code
+ */
+int ecp_gen_key( ecp_keypair *key, int (*f_rng)(void *), void *p_rng );
+
+/**
+ * \brief          Free the components of a key pair
+ */
+void ecp_free( ecp_keypair *key );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ecp.h */
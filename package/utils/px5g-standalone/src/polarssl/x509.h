@@ -36,6 +36,7 @@
 #define POLARSSL_X509_H
 
 #include "polarssl/rsa.h"
+#include "polarssl/ecp.h"
 
 #define POLARSSL_ERR_ASN1_OUT_OF_DATA                      -0x0014
 #define POLARSSL_ERR_ASN1_UNEXPECTED_TAG                   -0x0016
@@ -120,6 +121,7 @@
 #define OID_PKCS1_RSA_SHA       "\x2A\x86\x48\x86\xF7\x0D\x01\x01\x05"
 #define OID_PKCS9               "\x2A\x86\x48\x86\xF7\x0D\x01\x09"
 #define OID_PKCS9_EMAIL         "\x2A\x86\x48\x86\xF7\x0D\x01\x09\x01"
+#define OID_EC_P256             "\x2A\x86\x48\xCE\x3D\x03\x01\x07"
 
 /*
  * Structures for parsing X.509 certificates
@@ -358,6 +360,19 @@ int x509write_keyfile( rsa_context *rsa,
                        char *path,
                        int format );
 
+/*
+ * \brief          Write a private EC key into a file
+ *
+ * \param ec       points to a P-256 key pair
+ * \param path     filename to write the key to
+ * \param format   X509_OUTPUT_DER or X509_OUTPUT_PEM
+ *
+ * \return         0 if successful, or a specific X509 error code
+ */
+int x509write_eckeyfile( ecp_keypair *ec,
+                         char *path,
+                         int format );
+
 /**
  * \brief          Add a public key to certificate
  *
@@ -522,6 +537,16 @@ int x509write_create_csr( x509_raw *chain, rsa_context *privkey );
  */
 int x509write_serialize_key( rsa_context *rsa, x509_node *node );
 
+/**
+ * \brief           Serialize a P-256 key pair into DER (RFC 5915)
+ *
+ * \param ec        a P-256 key pair for output
+ * \param node      a x509 node for write into
+ *
+ * \return          0 if successful, or a specific X509 error code
+ */
+int x509write_serialize_eckey( ecp_keypair *ec, x509_node *node );
+
 /**
  * \brief          Unallocate all raw certificate data
  */
@@ -27,6 +27,7 @@
 #include "polarssl/bignum.h"
 #include "polarssl/x509.h"
 #include "polarssl/rsa.h"
+#include "polarssl/ecp.h"
 
 #define PX5G_VERSION "0.1"
 #define PX5G_COPY "Copyright (c) 2009 Steven Barth <steven@midlink.org>"
@@ -75,6 +76,41 @@ int rsakey(char **arg) {
 	return 0;
 }
 
+int eckey(char **arg) {
+	havege_state hs;
+	ecp_keypair ec;
+
+	char *path = NULL;
+	int flag = X509_OUTPUT_PEM;
+
+	while (*arg && **arg == '-') {
+		if (!strcmp(*arg, "-out") && arg[1]) {
+			path = arg[1];
+			arg++;
+		} else if (!strcmp(*arg, "-der")) {
+			flag = X509_OUTPUT_DER;
+		}
+		arg++;
+	}
+
+	havege_init(&hs);
+	ecp_init(&ec);
+
+	fprintf(stderr, "Generating EC private key, P-256 curve\n");
+	if (ecp_gen_key(&ec, havege_rand, &hs)) {
+		fprintf(stderr, "error: key generation failed\n");
+		return 1;
+	}
+
+	if (x509write_eckeyfile(&ec, path, flag)) {
+		fprintf(stderr, "error: I/O error\n");
+		return 1;
+	}
+
+	ecp_free(&ec);
+	return 0;
+}
+
 int selfsigned(char **arg) {
 	havege_state hs;
 	rsa_context rsa;
@@ -188,6 +224,8 @@ int main(int argc, char *argv[]) {
 		//Usage
 	} else if (!strcmp(argv[1], "rsakey")) {
 		return rsakey(argv+2);
+	} else if (!strcmp(argv[1], "eckey")) {
+		return eckey(argv+2);
 	} else if (!strcmp(argv[1], "selfsigned")) {
 		return selfsigned(argv+2);
 	}
@@ -195,6 +233,6 @@ int main(int argc, char *argv[]) {
 	fprintf(stderr,
 		"PX5G X.509 Certificate Generator Utility v" PX5G_VERSION "\n" PX5G_COPY
 		"\nbased on PolarSSL by Christophe Devine and Paul Bakker\n\n");
-	fprintf(stderr, "Usage: %s [rsakey|selfsigned]\n", *argv);
+	fprintf(stderr, "Usage: %s [rsakey|eckey|selfsigned]\n", *argv);
 	return 1;
 }
@@ -290,6 +290,24 @@ ifeq ($(CONFIG_BUILD_LOG),y)
   BUILD_LOG:=1
 endif
 
+ifeq ($(CONFIG_BUILD_PROFILE),y)
+  BUILD_PROFILE:=1
+endif
+
+ifneq ($(BUILD_PROFILE),)
+  export BUILD_PROFILE_LOG:=$(BUILD_LOG_DIR)/profile.txt
+endif
+
+# Parameters: <target> <stage>
+define BuildProfile
+  $(if $(BUILD_PROFILE),$(1): SHELL:=$(SCRIPT_DIR)/build-profile.py stage $(2) -- $(SHELL))
+endef
+
+# Parameters: <subdir> <target>
+define BuildProfile/Target
+  $(if $(BUILD_PROFILE),$(1)/$(2): SHELL:=$(SCRIPT_DIR)/build-profile.py target $(1) $(2) -- $(SHELL))
+endef
+
 export BISON_PKGDATADIR:=$(STAGING_DIR_HOST)/share/bison
 export M4:=$(STAGING_DIR_HOST)/bin/m4
 
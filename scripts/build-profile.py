@@ -0,0 +1,342 @@
+#!/usr/bin/env python
+"""
+# OpenWrt build time profiler.
+#
+# Records wall clock, CPU time and peak RSS of build steps into a log
+# and summarizes the log afterwards.
+#
+# Copyright (C) 2015 OpenWrt.org
+#
+# This is free software, licensed under the GNU General Public License v2.
+# See /LICENSE for more information.
+"""
+
+from __future__ import print_function
+
+import sys
+import os
+import re
+import time
+import errno
+import signal
+import getopt
+
+# Log record fields, tab separated, one record per line
+FIELDS = ("kind", "name", "stage", "start", "end", "utime", "stime", "maxrss", "status")
+
+# Top level directories in the order the main Makefile builds them
+GROUPS = ("tools", "toolchain", "target", "package")
+
+
+def log_record(kind, name, stage, start, end, ru, status):
+	logfile = os.environ.get("BUILD_PROFILE_LOG")
+	if not logfile:
+		return
+	maxrss = ru.ru_maxrss
+	if sys.platform == "darwin":
+		maxrss //= 1024
+	line = "%s\t%s\t%s\t%.3f\t%.3f\t%.3f\t%.3f\t%d\t%d\n" % (
+		kind, name, stage, start, end,
+		ru.ru_utime, ru.ru_stime, maxrss, status)
+	try:
+		try:
+			os.makedirs(os.path.dirname(logfile))
+		except OSError:
+			pass
+		# a single O_APPEND write keeps records of parallel jobs intact
+		fd = os.open(logfile, os.O_WRONLY | os.O_APPEND | os.O_CREAT, 0o644)
+		os.write(fd, line.encode())
+		os.close(fd)
+	except OSError as e:
+		sys.stderr.write("build-profile: %s: %s\n" % (logfile, e.strerror))
+
+def run(kind, name, stage, cmd, env):
+	start = time.time()
+	pid = os.fork()
+	if pid == 0:
+		try:
+			os.execvpe(cmd[0], cmd, env)
+		except OSError as e:
+			sys.stderr.write("build-profile: %s: %s\n" % (cmd[0], e.strerror))
+		os._exit(127)
+
+	# like time(1), leave terminal signals to the child
+	signal.signal(signal.SIGINT, signal.SIG_IGN)
+	signal.signal(signal.SIGQUIT, signal.SIG_IGN)
+	while True:
+		try:
+			(pid, status, ru) = os.wait4(pid, 0)
+			break
+		except OSError as e:
+			if e.errno != errno.EINTR:
+				raise
+	end = time.time()
+
+	if os.WIFSIGNALED(status):
+		status = 128 + os.WTERMSIG(status)
+	else:
+		status = os.WEXITSTATUS(status)
+	log_record(kind, name, stage, start, end, ru, status)
+	return status
+
+def default_name():
+	cwd = os.getcwd()
+	topdir = os.environ.get("TOPDIR")
+	if topdir and cwd.startswith(topdir.rstrip("/") + "/"):
+		return cwd[len(topdir.rstrip("/")) + 1:]
+	return cwd
+
+def shell_env(cmd):
+	env = dict(os.environ)
+	# make exports the profiling SHELL, hand the real one to the commands
+	env["SHELL"] = " ".join(cmd[:-2])
+	return env
+
+def cmd_target(args):
+	"""target <dir> <target> -- <shell> <flags> <line>: SHELL of subdir targets"""
+	if len(args) < 5 or args[2] != "--":
+		return usage()
+	cmd = args[3:]
+	env = shell_env(cmd)
+	env["BUILD_PROFILE_NAME"] = args[0]
+	return run("target", args[0], args[1], cmd, env)
+
+def cmd_stage(args):
+	"""stage <stage> -- <shell> <flags> <line>: SHELL of package stamp rules"""
+	if len(args) < 4 or args[1] != "--":
+		return usage()
+	cmd = args[2:]
+	name = os.environ.get("BUILD_PROFILE_NAME") or default_name()
+	return run("stage", name, args[0], cmd, shell_env(cmd))
+
+def read_log(logfile):
+	records = []
+	f = open(logfile)
+	for line in f:
+		fields = line.rstrip("\n").split("\t")
+		if len(fields) != len(FIELDS):
+			continue
+		rec = dict(zip(FIELDS, fields))
+		for key in ("start", "end", "utime", "stime"):
+			rec[key] = float(rec[key])
+		rec["maxrss"] = int(rec["maxrss"])
+		rec["status"] = int(rec["status"])
+		rec["wall"] = rec["end"] - rec["start"]
+		rec["cpu"] = rec["utime"] + rec["stime"]
+		records.append(rec)
+	f.close()
+	return records
+
+def group_of(name):
+	top = name.split("/")[0]
+	if top in GROUPS:
+		return GROUPS.index(top)
+	return len(GROUPS)
+
+def read_deps(topdir):
+	"""Collect '$(curdir)/A/<target> := $(curdir)/B/<target>' style
+	dependencies from the generated package deps and the tools and
+	toolchain Makefiles."""
+	deps = {}
+	sources = (
+		("package", os.path.join(topdir, "tmp", ".packagedeps")),
+		("tools", os.path.join(topdir, "tools", "Makefile")),
+		("toolchain", os.path.join(topdir, "toolchain", "Makefile")),
+	)
+	lhs = re.compile(r'^\s*\$\(curdir\)/(\S+)/[\w-]+\s*[:+]?=(.*)$')
+	rhs = re.compile(r'\$\(curdir\)/([^\s,()$]+)/(?:compile|install|prepare)\b')
+	for (curdir, path) in sources:
+		try:
+			f = open(path)
+		except IOError:
+			continue
+		for line in f:
+			m = lhs.match(line)
+			if not m or "$" in m.group(1):
+				continue
+			name = curdir + "/" + m.group(1)
+			for dep in rhs.findall(m.group(2)):
+				deps.setdefault(name, set()).add(curdir + "/" + dep)
+		f.close()
+	return deps
+
+def critical_path(weight, deps):
+	"""Longest chain through the dependency graph, with the top level
+	directories built one after another as in the main Makefile."""
+	names = sorted(weight.keys(), key=lambda n: (group_of(n), n))
+	best = {}
+	prev = {}
+
+	def visit(name, stack):
+		if name in best:
+			return best[name]
+		stack.add(name)
+		length = 0.0
+		via = None
+		for dep in deps.get(name, ()):
+			if dep not in weight or dep in stack:
+				continue
+			if visit(dep, stack) > length:
+				length = best[dep]
+				via = dep
+		# everything of the previous group finished before this one started
+		g = group_of(name)
+		for other in barrier:
+			if group_of(other) < g and best[other] > length:
+				length = best[other]
+				via = other
+		stack.discard(name)
+		best[name] = length + weight[name]
+		prev[name] = via
+		return best[name]
+
+	barrier = []
+	for g in range(len(GROUPS) + 1):
+		group = [n for n in names if group_of(n) == g]
+		for name in group:
+			visit(name, set())
+		if group:
+			barrier.append(max(group, key=lambda n: best[n]))
+
+	if not best:
+		return (0.0, [])
+	name = max(best, key=lambda n: best[n])
+	total = best[name]
+	path = []
+	while name:
+		path.append(name)
+		name = prev[name]
+	path.reverse()
+	return (total, path)
+
+def concurrency(records):
+	"""Time spent with n targets running at once."""
+	events = []
+	for rec in records:
+		events.append((rec["start"], 1))
+		events.append((rec["end"], -1))
+	events.sort()
+	hist = {}
+	running = 0
+	last = None
+	for (t, delta) in events:
+		if last is not None and running > 0:
+			hist[running] = hist.get(running, 0.0) + t - last
+		running += delta
+		last = t
+	return hist
+
+def fmt_time(sec):
+	if sec >= 3600:
+		return "%dh%02dm%02ds" % (sec // 3600, sec % 3600 // 60, sec % 60)
+	if sec >= 60:
+		return "%dm%02ds" % (sec // 60, sec % 60)
+	return "%.1fs" % sec
+
+def cmd_report(args):
+	"""report [-n <count>] [-j <jobs>] [-t <topdir>] <logfile>"""
+	try:
+		(opts, args) = getopt.getopt(args, "n:j:t:")
+	except getopt.GetoptError:
+		return usage()
+	count = 20
+	jobs = 0
+	topdir = os.environ.get("TOPDIR", ".")
+	for (o, v) in opts:
+		if o == "-n":
+			count = int(v)
+		elif o == "-j":
+			jobs = int(v)
+		elif o == "-t":
+			topdir = v
+	if len(args) != 1:
+		return usage()
+
+	records = read_log(args[0])
+	if not records:
+		print("No build profile records in %s" % args[0])
+		return 1
+
+	targets = [r for r in records if r["kind"] == "target"]
+	stages = [r for r in records if r["kind"] == "stage"]
+	span = max(r["end"] for r in records) - min(r["start"] for r in records)
+
+	pkgs = {}
+	for rec in targets:
+		pkg = pkgs.setdefault(rec["name"], {"wall": 0.0, "cpu": 0.0, "maxrss": 0, "stages": {}, "failed": False})
+		pkg["wall"] += rec["wall"]
+		pkg["cpu"] += rec["cpu"]
+		pkg["maxrss"] = max(pkg["maxrss"], rec["maxrss"])
+		pkg["failed"] = pkg["failed"] or rec["status"] != 0
+	stage_total = {}
+	for rec in stages:
+		pkg = pkgs.setdefault(rec["name"], {"wall": 0.0, "cpu": 0.0, "maxrss": 0, "stages": {}, "failed": False})
+		pkg["stages"][rec["stage"]] = pkg["stages"].get(rec["stage"], 0.0) + rec["wall"]
+		st = stage_total.setdefault(rec["stage"], {"wall": 0.0, "cpu": 0.0, "maxrss": 0, "pkgs": set()})
+		st["wall"] += rec["wall"]
+		st["cpu"] += rec["cpu"]
+		st["maxrss"] = max(st["maxrss"], rec["maxrss"])
+		st["pkgs"].add(rec["name"])
+
+	busy = sum(r["wall"] for r in targets)
+	cpu = sum(r["cpu"] for r in targets)
+	print("Build span %s, %d directories, %s in targets, %s CPU" % (
+		fmt_time(span), len(pkgs), fmt_time(busy), fmt_time(cpu)))
+	if span > 0:
+		line = "Average parallelism %.2f targets, %.2f CPUs busy" % (busy / span, cpu / span)
+		if jobs > 0:
+			line += " (%.0f%% of -j%d)" % (100.0 * cpu / span / jobs, jobs)
+		print(line)
+
+	print("\nStage           dirs        wall         cpu  peak RSS")
+	order = ("download", "prepare", "configure", "compile", "install", "package")
+	for stage in sorted(stage_total, key=lambda s: (s not in order, order.index(s) if s in order else 0, s)):
+		st = stage_total[stage]
+		print("%-12s %7d %11s %11s %7dM" % (stage, len(st["pkgs"]), fmt_time(st["wall"]), fmt_time(st["cpu"]), st["maxrss"] // 1024))
+
+	print("\nTop %d directories by wall time:" % count)
+	top = sorted(pkgs, key=lambda n: -pkgs[n]["wall"])[:count]
+	for name in top:
+		pkg = pkgs[name]
+		detail = " ".join("%s=%s" % (s, fmt_time(pkg["stages"][s])) for s in
+				  sorted(pkg["stages"], key=lambda s: -pkg["stages"][s]))
+		print("%10s %10s %6dM  %s%s  %s" % (fmt_time(pkg["wall"]), fmt_time(pkg["cpu"]),
+			pkg["maxrss"] // 1024, name, pkg["failed"] and " (failed)" or "", detail))
+
+	hist = concurrency(targets)
+	if span > 0 and hist:
+		print("\nTargets running at once:")
+		for n in sorted(hist):
+			if hist[n] >= span * 0.005:
+				print("%5d %10s %5.1f%%" % (n, fmt_time(hist[n]), 100.0 * hist[n] / span))
+
+	weight = {}
+	for rec in targets:
+		if rec["stage"] != "download":
+			weight[rec["name"]] = weight.get(rec["name"], 0.0) + rec["wall"]
+	(total, path) = critical_path(weight, read_deps(topdir))
+	if path:
+		print("\nCritical path %s (%.0f%% of the build span):" % (fmt_time(total), span > 0 and 100.0 * total / span or 0))
+		for name in path:
+			print("%10s  %s" % (fmt_time(weight[name]), name))
+	return 0
+
+def usage():
+	print("Usage: " + sys.argv[0] + " <command> [args]")
+	print("")
+	for cmd in (cmd_target, cmd_stage, cmd_report):
+		print("  " + cmd.__doc__.split("\n")[0])
+	return 2
+
+def main(argv):
+	commands = {
+		"target": cmd_target,
+		"stage": cmd_stage,
+		"report": cmd_report,
+	}
+	if len(argv) < 2 or argv[1] not in commands:
+		return usage()
+	return commands[argv[1]](argv[2:])
+
+if __name__ == "__main__":
+	sys.exit(main(sys.argv))
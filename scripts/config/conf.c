@@ -495,6 +495,7 @@ int main(int ac, char **av)
 	const char *name, *defconfig_file = NULL /* gcc uninit */;
 	struct stat tmpstat;
 	const char *input_file = NULL, *output_file = NULL;
+	double start;
 
 	setlocale(LC_ALL, "");
 	bindtextdomain(PACKAGE, LOCALEDIR);
@@ -564,7 +565,9 @@ int main(int ac, char **av)
 		exit(1);
 	}
 	name = av[optind];
+	start = timing_start();
 	conf_parse(name);
+	timing_stop(start, "parse");
 	//zconfdump(stdout);
 	if (sync_kconfig) {
 		name = conf_get_configname();
@@ -579,6 +582,7 @@ int main(int ac, char **av)
 		}
 	}
 
+	start = timing_start();
 	switch (input_mode) {
 	case defconfig:
 		if (!defconfig_file)
@@ -606,6 +610,7 @@ int main(int ac, char **av)
 	default:
 		break;
 	}
+	timing_stop(start, "read");
 
 	if (sync_kconfig) {
 		if (conf_get_changed()) {
@@ -619,6 +624,7 @@ int main(int ac, char **av)
 		valid_stdin = tty_stdio;
 	}
 
+	start = timing_start();
 	switch (input_mode) {
 	case allnoconfig:
 		conf_set_all_new_symbols(def_no);
@@ -659,7 +665,9 @@ int main(int ac, char **av)
 			  input_mode != olddefconfig));
 		break;
 	}
+	timing_stop(start, "update");
 
+	start = timing_start();
 	if (sync_kconfig) {
 		/* silentoldconfig is used during the build so we shall update autoconf.
 		 * All other commands are only used to generate a config.
@@ -685,6 +693,7 @@ int main(int ac, char **av)
 			exit(1);
 		}
 	}
+	timing_stop(start, "write");
 	return 0;
 }
 
@@ -265,6 +265,7 @@ void conf_reset(int def)
 			sym->def[def].tri = no;
 		}
 	}
+	sym_clear_all_valid_later();
 }
 
 int conf_read_simple(const char *name, int def)
@@ -1092,6 +1093,7 @@ static bool randomize_choice_values(struct symbol *csym)
 	csym->flags |= SYMBOL_DEF_USER;
 	/* clear VALID to get value calculated */
 	csym->flags &= ~(SYMBOL_VALID);
+	sym_clear_all_valid_later();
 
 	return true;
 }
@@ -1114,6 +1116,7 @@ void set_all_choice_values(struct symbol *csym)
 	csym->flags |= SYMBOL_DEF_USER;
 	/* clear VALID to get value calculated */
 	csym->flags &= ~(SYMBOL_VALID | SYMBOL_NEED_SET_CHOICE_VALUES);
+	sym_clear_all_valid_later();
 }
 
 bool conf_set_all_new_symbols(enum conf_def_mode mode)
@@ -126,6 +126,9 @@ struct file *file_lookup(const char *name);
 int file_write_dep(const char *name);
 void *xmalloc(size_t size);
 void *xcalloc(size_t nmemb, size_t size);
+void *xrealloc(void *p, size_t size);
+double timing_start(void);
+void timing_stop(double start, const char *what);
 
 struct gstr {
 	size_t len;
@@ -148,6 +151,9 @@ extern struct expr *sym_env_list;
 
 void sym_init(void);
 void sym_clear_all_valid(void);
+void sym_clear_valid(struct symbol *sym);
+void sym_clear_all_valid_later(void);
+void sym_add_dependents(void);
 void sym_set_all_changed(void);
 void sym_set_changed(struct symbol *sym);
 struct symbol *sym_choice_default(struct symbol *sym);
@@ -653,9 +653,12 @@ static void conf(struct menu *menu, struct menu *active_menu)
 	list_add_tail(&stpart.entries, &trail);
 
 	while (1) {
+		double start = timing_start();
+
 		item_reset();
 		current_menu = menu;
 		build_conf(menu);
+		timing_stop(start, "menu update");
 		if (!child_count)
 			break;
 		set_subtitle();
@@ -957,7 +960,8 @@ static void conf_save(void)
 
 static int handle_exit(void)
 {
-	int res;
+	double start;
+	int res, err;
 
 	save_and_exit = 1;
 	reset_subtitle();
@@ -974,7 +978,10 @@ static int handle_exit(void)
 
 	switch (res) {
 	case 0:
-		if (conf_write(filename)) {
+		start = timing_start();
+		err = conf_write(filename);
+		timing_stop(start, "write");
+		if (err) {
 			fprintf(stderr, _("\n\n"
 					  "Error while writing of the configuration.\n"
 					  "Your configuration changes were NOT saved."
@@ -1008,6 +1015,7 @@ static void sig_handler(int signo)
 int main(int ac, char **av)
 {
 	char *mode;
+	double start;
 	int res;
 
 	setlocale(LC_ALL, "");
@@ -1016,8 +1024,12 @@ int main(int ac, char **av)
 
 	signal(SIGINT, sig_handler);
 
+	start = timing_start();
 	conf_parse(av[1]);
+	timing_stop(start, "parse");
+	start = timing_start();
 	conf_read(NULL);
+	timing_stop(start, "read");
 
 	mode = getenv("MENUCONFIG_MODE");
 	if (mode) {
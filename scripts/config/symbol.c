@@ -33,6 +33,12 @@ struct symbol *sym_defconfig_list;
 struct symbol *modules_sym;
 tristate modules_val;
 
+static bool dependents_valid;
+static bool clear_all_pending = true;
+static struct symbol **clear_queue;
+static int clear_queue_len, clear_queue_size;
+static struct expr *cycle_syms;
+
 struct expr *sym_env_list;
 
 static void sym_add_default(struct symbol *sym, const char *def)
@@ -274,6 +280,9 @@ static struct symbol *sym_calc_choice(struct symbol *sym)
 			flags &= def_sym->flags;
 	}
 
+	/* dropping the user value changes how the choice is calculated */
+	if (sym->flags & ~flags & SYMBOL_DEF_USER)
+		clear_all_pending = true;
 	sym->flags &= flags | ~SYMBOL_DEF_USER;
 
 	/* is the user choice visible? */
@@ -416,6 +425,8 @@ void sym_calc_value(struct symbol *sym)
 		if (modules_sym == sym) {
 			sym_set_all_changed();
 			modules_val = modules_sym->curr.tri;
+			/* values calculated with the old type are stale */
+			clear_all_pending = true;
 		}
 	}
 
@@ -444,6 +455,10 @@ void sym_clear_all_valid(void)
 	struct symbol *sym;
 	int i;
 
+	clear_all_pending = false;
+	for (i = 0; i < clear_queue_len; i++)
+		clear_queue[i]->flags &= ~SYMBOL_MARK;
+	clear_queue_len = 0;
 	for_all_symbols(i, sym)
 		sym->flags &= ~SYMBOL_VALID;
 	sym_add_change_count(1);
@@ -451,6 +466,150 @@ void sym_clear_all_valid(void)
 		sym_calc_value(modules_sym);
 }
 
+static void sym_add_dependent(struct symbol *sym, struct symbol *dep)
+{
+	struct expr *e;
+
+	if (sym->flags & SYMBOL_CONST || sym == dep)
+		return;
+	/* the dependents of a symbol are added in a row */
+	if (sym->dependents && sym->dependents->right.sym == dep)
+		return;
+	e = expr_alloc_one(E_LIST, sym->dependents);
+	e->right.sym = dep;
+	sym->dependents = e;
+}
+
+static void sym_add_expr_dependent(struct expr *e, struct symbol *dep)
+{
+	if (!e)
+		return;
+	switch (e->type) {
+	case E_OR:
+	case E_AND:
+		sym_add_expr_dependent(e->left.expr, dep);
+		sym_add_expr_dependent(e->right.expr, dep);
+		break;
+	case E_NOT:
+		sym_add_expr_dependent(e->left.expr, dep);
+		break;
+	case E_EQUAL:
+	case E_UNEQUAL:
+	case E_RANGE:
+		sym_add_dependent(e->left.sym, dep);
+		sym_add_dependent(e->right.sym, dep);
+		break;
+	case E_SYMBOL:
+		sym_add_dependent(e->left.sym, dep);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * Record for every symbol which symbols are calculated from it, so that
+ * sym_clear_valid() can find everything a change affects. Called once
+ * after the menus are finalized.
+ */
+void sym_add_dependents(void)
+{
+	struct symbol *sym, *choice_sym;
+	struct property *prop;
+	struct expr *e;
+	int i;
+
+	for_all_symbols(i, sym) {
+		sym_add_expr_dependent(sym->dir_dep.expr, sym);
+		sym_add_expr_dependent(sym->rev_dep.expr, sym);
+		for (prop = sym->prop; prop; prop = prop->next) {
+			if (prop->type == P_SELECT)
+				continue;
+			if (prop->type == P_CHOICE) {
+				/* a choice and its values depend on each other */
+				expr_list_for_each_sym(prop->expr, e, choice_sym) {
+					sym_add_dependent(choice_sym, sym);
+					sym_add_dependent(sym, choice_sym);
+				}
+				continue;
+			}
+			sym_add_expr_dependent(prop->visible.expr, sym);
+			sym_add_expr_dependent(prop->expr, sym);
+		}
+	}
+	dependents_valid = true;
+}
+
+static void sym_queue_clear(struct symbol *sym)
+{
+	if (sym->flags & SYMBOL_MARK)
+		return;
+	if (clear_queue_len == clear_queue_size) {
+		clear_queue_size = clear_queue_size ? clear_queue_size * 2 : 256;
+		clear_queue = xrealloc(clear_queue,
+				       clear_queue_size * sizeof(*clear_queue));
+	}
+	sym->flags |= SYMBOL_MARK;
+	clear_queue[clear_queue_len++] = sym;
+}
+
+/*
+ * The user value of the symbol was set without changing its value, but
+ * the value may be calculated differently from now on. Leave it to the
+ * next change to recalculate it, as a full clear would.
+ */
+static void sym_clear_valid_later(struct symbol *sym)
+{
+	if (dependents_valid && !clear_all_pending)
+		sym_queue_clear(sym);
+}
+
+/*
+ * Values or flags were changed behind the back of the dependency
+ * tracking (reading a config, setting up choices), so the next change
+ * has to recalculate everything.
+ */
+void sym_clear_all_valid_later(void)
+{
+	clear_all_pending = true;
+}
+
+/*
+ * Like sym_clear_all_valid(), but only for the symbol and the symbols
+ * that (indirectly) depend on it.
+ */
+void sym_clear_valid(struct symbol *sym)
+{
+	struct symbol *dep;
+	struct expr *e;
+	int i;
+
+	if (!dependents_valid || clear_all_pending) {
+		sym_clear_all_valid();
+		return;
+	}
+
+	sym_queue_clear(sym);
+	expr_list_for_each_sym(cycle_syms, e, dep)
+		sym_queue_clear(dep);
+	for (i = 0; i < clear_queue_len; i++) {
+		sym = clear_queue[i];
+		sym->flags &= ~SYMBOL_VALID;
+		expr_list_for_each_sym(sym->dependents, e, dep)
+			sym_queue_clear(dep);
+	}
+	for (i = 0; i < clear_queue_len; i++)
+		clear_queue[i]->flags &= ~SYMBOL_MARK;
+	clear_queue_len = 0;
+
+	/* the modules symbol changes the type of every tristate symbol */
+	if (modules_sym && !(modules_sym->flags & SYMBOL_VALID)) {
+		sym_clear_all_valid();
+		return;
+	}
+	sym_add_change_count(1);
+}
+
 void sym_set_changed(struct symbol *sym)
 {
 	struct property *prop;
@@ -521,7 +680,9 @@ bool sym_set_tristate_value(struct symbol *sym, tristate val)
 
 	sym->def[S_DEF_USER].tri = val;
 	if (oldval != val)
-		sym_clear_all_valid();
+		sym_clear_valid(sym);
+	else
+		sym_clear_valid_later(sym);
 
 	return true;
 }
@@ -673,12 +834,14 @@ bool sym_set_string_value(struct symbol *sym, const char *newval)
 		*val++ = 'x';
 	} else if (!oldval || strcmp(oldval, newval))
 		sym->def[S_DEF_USER].val = val = xmalloc(size);
-	else
+	else {
+		sym_clear_valid_later(sym);
 		return true;
+	}
 
 	strcpy(val, newval);
 	free((void *)oldval);
-	sym_clear_all_valid();
+	sym_clear_valid(sym);
 
 	return true;
 }
@@ -1073,6 +1236,23 @@ static void dep_stack_remove(void)
 		check_top->next = NULL;
 }
 
+/*
+ * The values in a recursive dependency depend on the order they happen to
+ * be calculated in, so sym_clear_valid() recalculates them on every change
+ * just like a full clear does.
+ */
+static void sym_add_cycle(struct symbol *sym)
+{
+	struct expr *e;
+
+	if (sym->flags & SYMBOL_CYCLE)
+		return;
+	sym->flags |= SYMBOL_CYCLE;
+	e = expr_alloc_one(E_LIST, cycle_syms);
+	e->right.sym = sym;
+	cycle_syms = e;
+}
+
 /*
  * Called when we have detected a recursive dependency.
  * check_top point to the top of the stact so we use
@@ -1101,6 +1281,7 @@ static void sym_check_print_recursive(struct symbol *last_sym)
 
 	for (; stack; stack = stack->next) {
 		sym = stack->sym;
+		sym_add_cycle(sym);
 		next_sym = stack->next ? stack->next->sym : last_sym;
 		prop = stack->prop;
 		if (prop == NULL)
@@ -8,6 +8,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 #include "lkc.h"
 
 /* file already present in list? If not add it */
@@ -155,3 +156,69 @@ void *xcalloc(size_t nmemb, size_t size)
 	fprintf(stderr, "Out of memory.\n");
 	exit(1);
 }
+
+void *xrealloc(void *p, size_t size)
+{
+	p = realloc(p, size);
+	if (p)
+		return p;
+	fprintf(stderr, "Out of memory.\n");
+	exit(1);
+}
+
+/*
+ * Optional timing of the slow steps, enabled by setting KCONFIG_TIMING.
+ * The totals are printed to stderr when the program exits.
+ */
+#define TIMING_MAX	16
+
+static struct timing {
+	const char *what;
+	unsigned int count;
+	double total;
+} timings[TIMING_MAX];
+
+static int timing_enabled = -1;
+
+static double timing_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static void timing_print(void)
+{
+	int i;
+
+	for (i = 0; i < TIMING_MAX && timings[i].what; i++)
+		fprintf(stderr, "kconfig: %-16s %6u times %10.3f ms\n",
+			timings[i].what, timings[i].count,
+			timings[i].total * 1000);
+}
+
+double timing_start(void)
+{
+	if (timing_enabled < 0) {
+		timing_enabled = getenv("KCONFIG_TIMING") != NULL;
+		if (timing_enabled)
+			atexit(timing_print);
+	}
+	return timing_enabled ? timing_now() : 0;
+}
+
+void timing_stop(double start, const char *what)
+{
+	int i;
+
+	if (timing_enabled <= 0)
+		return;
+
+	for (i = 0; i < TIMING_MAX - 1; i++)
+		if (!timings[i].what || !strcmp(timings[i].what, what))
+			break;
+	timings[i].what = what;
+	timings[i].count++;
+	timings[i].total += timing_now() - start;
+}
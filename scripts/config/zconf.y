@@ -525,6 +525,7 @@ void conf_parse(const char *name)
 	}
 	if (zconfnerrs)
 		exit(1);
+	sym_add_dependents();
 	sym_set_change_count(1);
 }
 
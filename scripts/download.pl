@@ -10,8 +10,21 @@ use strict;
 use warnings;
 use File::Basename;
 use File::Copy;
+use Fcntl qw(:flock);
+use Digest::MD5;
 
-@ARGV > 2 or die "Syntax: $0 <target dir> <filename> <md5sum> [<mirror> ...]\n";
+sub prefetch($$);
+
+@ARGV == 2 || @ARGV == 3 and $ARGV[0] eq '--prefetch' and prefetch($ARGV[1], $ARGV[2] || 4);
+
+my $queue;
+@ARGV > 1 and $ARGV[0] eq '--queue' and do {
+	shift @ARGV;
+	$queue = shift @ARGV;
+};
+
+@ARGV > 2 or die "Syntax: $0 [--queue <file>] <target dir> <filename> <md5sum> [<mirror> ...]\n" .
+                 "        $0 --prefetch <file> [<jobs>]\n";
 
 my $target = shift @ARGV;
 my $filename = shift @ARGV;
@@ -20,6 +33,22 @@ my $scriptdir = dirname($0);
 my @mirrors;
 my $ok;
 
+sub config_values($) {
+	my $name = shift;
+	my @values;
+
+	$ENV{'TOPDIR'} and open CONFIG, "<".$ENV{'TOPDIR'}."/.config" and do {
+		while (<CONFIG>) {
+			/^CONFIG_$name="(.+)"/ and push @values, split(/;/, $1);
+		}
+		close CONFIG;
+	};
+
+	return @values;
+}
+
+my $cache = $ENV{'DOWNLOAD_CACHE'} || (config_values("DOWNLOAD_CACHE"))[0];
+
 sub localmirrors {
 	my @mlist;
 	open LM, "$scriptdir/localmirrors" and do {
@@ -29,16 +58,7 @@ sub localmirrors {
 		}
 		close LM;
 	};
-	open CONFIG, "<".$ENV{'TOPDIR'}."/.config" and do {
-		while (<CONFIG>) {
-			/^CONFIG_LOCALMIRROR="(.+)"/ and do {
-				chomp;
-				my @local_mirrors = split(/;/, $1);
-				push @mlist, @local_mirrors;
-			};
-		}
-		close CONFIG;
-	};
+	push @mlist, config_values("LOCALMIRROR");
 
 	my $mirror = $ENV{'DOWNLOAD_MIRROR'};
 	$mirror and push @mlist, split(/;/, $mirror);
@@ -46,22 +66,143 @@ sub localmirrors {
 	return @mlist;
 }
 
-sub which($) {
-	my $prog = shift;
-	my $res = `which $prog`;
-	$res or return undef;
-	$res =~ /^no / and return undef;
-	$res =~ /not found/ and return undef;
-	return $res;
+# hash the data while it is transferred, the checksum picks the algorithm
+sub hash_new() {
+	if ($md5sum =~ /^[0-9a-f]{64}$/i) {
+		require Digest::SHA;
+		return Digest::SHA->new(256);
+	}
+	return Digest::MD5->new;
+}
+
+sub hash_file($) {
+	my $file = shift;
+	my $hash = hash_new();
+
+	open my $fh, "<", $file or return "";
+	binmode $fh;
+	$hash->addfile($fh);
+	close $fh;
+
+	return $hash->hexdigest;
+}
+
+# copy a local file to the download location, hashing it on the way
+sub copy_file($) {
+	my $src = shift;
+	my $hash = hash_new();
+	my $buffer;
+
+	open my $in, "<", $src or return;
+	open my $out, ">", "$target/$filename.dl" or do {
+		close $in;
+		return;
+	};
+	binmode $in;
+	binmode $out;
+	while (read $in, $buffer, 1048576) {
+		$hash->add($buffer);
+		print $out $buffer;
+	}
+	close $in;
+	close $out or return;
+
+	return $hash->hexdigest;
+}
+
+# downloads are stored in the shared cache under their checksum
+sub cache_path() {
+	$cache and $md5sum =~ /^[0-9a-f]{32}([0-9a-f]{32})?$/i or return;
+	return "$cache/".substr(lc($md5sum), 0, 2)."/".lc($md5sum);
 }
 
-my $md5cmd = which("md5sum") || which("md5") || die 'no md5 checksum program found, please install md5 or md5sum';
-chomp $md5cmd;
+sub cache_fetch() {
+	my $path = cache_path();
+	my $sum;
+
+	$path and -f $path or return;
+
+	system("mkdir", "-p", "$target/") unless -d $target;
+	unlink "$target/$filename.dl";
+	if (link($path, "$target/$filename.dl")) {
+		$sum = hash_file("$target/$filename.dl");
+	} else {
+		$sum = copy_file($path);
+	}
+
+	if (!$sum or $sum ne lc($md5sum)) {
+		print STDERR "Cached copy of $filename is corrupted - ignoring it.\n";
+		unlink $path;
+		cleanup();
+		return;
+	}
+
+	print("Using $filename from the download cache\n");
+	unlink "$target/$filename";
+	rename("$target/$filename.dl", "$target/$filename");
+	return 1;
+}
+
+sub cache_store() {
+	my $path = cache_path();
+
+	$path and ! -f $path or return;
+
+	system("mkdir", "-p", dirname($path));
+	link("$target/$filename", "$path.$$") or
+		copy("$target/$filename", "$path.$$") or do {
+			unlink "$path.$$";
+			return;
+		};
+	rename("$path.$$", $path) or unlink "$path.$$";
+}
+
+# file name index of a local mirror, replaces a find run for every file
+sub mirror_lookup($) {
+	my $mirror = shift;
+	my $index = ($ENV{'TMP_DIR'} || $target)."/.mirror-index-".Digest::MD5::md5_hex($mirror);
+	my $rebuilt;
+	my @found;
+
+	while (1) {
+		if (! -f $index or (stat($index))[9] < (stat($mirror))[9] or $rebuilt) {
+			open FIND, "find '$mirror' -follow -type f 2>/dev/null |" or return;
+			open INDEX, ">", "$index.$$" or do {
+				close FIND;
+				return;
+			};
+			while (my $line = <FIND>) {
+				chomp $line;
+				print INDEX basename($line)."\t$line\n";
+			}
+			close FIND;
+			close INDEX;
+			rename("$index.$$", $index);
+			$rebuilt = 1;
+		}
+
+		@found = ();
+		open INDEX, "<", $index or return;
+		while (<INDEX>) {
+			chomp;
+			my ($name, $path) = split /\t/, $_, 2;
+			$name eq $filename and push @found, $path;
+		}
+		close INDEX;
+
+		# a stale index or a miss rebuilds it once
+		last if $rebuilt or (@found and !grep { ! -f $_ } @found);
+		$rebuilt = 1;
+	}
+
+	return @found;
+}
 
 sub download
 {
 	my $mirror = shift;
 	my $options = $ENV{WGET_OPTIONS} || "";
+	my $sum;
 
 	$mirror =~ s!/$!!;
 
@@ -76,61 +217,52 @@ sub download
 			system("mkdir", "-p", "$target/");
 		}
 
-		if (! open TMPDLS, "find $mirror -follow -name $filename 2>/dev/null |") {
-			print("Failed to search for $filename in $mirror\n");
-			return;
-		}
-
-		my $link;
+		my @links = mirror_lookup($mirror);
 
-		while (defined(my $line = readline TMPDLS)) {
-			chomp ($link = $line);
-			if ($. > 1) {
-				print("$. or more instances of $filename in $mirror found . Only one instance allowed.\n");
-				return;
-			}
+		if (@links > 1) {
+			print(scalar(@links)." or more instances of $filename in $mirror found . Only one instance allowed.\n");
+			return;
 		}
 
-		close TMPDLS;
-
-		if (! $link) {
+		if (! @links) {
 			print("No instances of $filename found in $mirror.\n");
 			return;
 		}
 
-		print("Copying $filename from $link\n");
-		copy($link, "$target/$filename.dl");
+		print("Copying $filename from $links[0]\n");
+		$sum = copy_file($links[0]);
 
-		if (system("$md5cmd '$target/$filename.dl' > '$target/$filename.md5sum'")) {
-			print("Failed to generate md5 sum for $filename\n");
+		if (! $sum) {
+			print("Failed to copy $filename\n");
+			cleanup();
 			return;
 		}
 	} else {
+		my $hash = hash_new();
+
 		open WGET, "wget -t5 --timeout=20 --no-check-certificate $options -O- '$mirror/$filename' |" or die "Cannot launch wget.\n";
-		open MD5SUM, "| $md5cmd > '$target/$filename.md5sum'" or die "Cannot launch md5sum.\n";
 		open OUTPUT, "> $target/$filename.dl" or die "Cannot create file $target/$filename.dl: $!\n";
+		binmode WGET;
+		binmode OUTPUT;
 		my $buffer;
 		while (read WGET, $buffer, 1048576) {
-			print MD5SUM $buffer;
+			$hash->add($buffer);
 			print OUTPUT $buffer;
 		}
-		close MD5SUM;
 		close WGET;
+		my $failed = $? >> 8;
 		close OUTPUT;
 
-		if ($? >> 8) {
+		if ($failed) {
 			print STDERR "Download failed.\n";
 			cleanup();
 			return;
 		}
+		$sum = $hash->hexdigest;
 	}
 
-	my $sum = `cat "$target/$filename.md5sum"`;
-	$sum =~ /^(\w+)\s*/ or die "Could not generate md5sum\n";
-	$sum = $1;
-
-	if (($md5sum =~ /\w{32}/) and ($sum ne $md5sum)) {
-		print STDERR "MD5 sum of the downloaded file does not match (file: $sum, requested: $md5sum) - deleting download.\n";
+	if (($md5sum =~ /\w{32}/) and ($sum ne lc($md5sum))) {
+		print STDERR "Checksum of the downloaded file does not match (file: $sum, requested: $md5sum) - deleting download.\n";
 		cleanup();
 		return;
 	}
@@ -138,12 +270,79 @@ sub download
 	unlink "$target/$filename";
 	system("mv", "$target/$filename.dl", "$target/$filename");
 	cleanup();
+	cache_store();
 }
 
 sub cleanup
 {
 	unlink "$target/$filename.dl";
-	unlink "$target/$filename.md5sum";
+}
+
+# queue the download for a later parallel prefetch run
+sub enqueue
+{
+	open QUEUE, ">>", $queue or die "Cannot open download queue $queue: $!\n";
+	flock QUEUE, LOCK_EX;
+	print QUEUE join("\t", $target, $filename, $md5sum, @ARGV)."\n";
+	close QUEUE;
+}
+
+sub prefetch($$)
+{
+	my $queue = shift;
+	my $jobs = shift;
+	my (%seen, %running, @pending);
+	my ($done, $failed) = (0, 0);
+
+	open QUEUE, "<", $queue or exit 0;
+	while (<QUEUE>) {
+		chomp;
+		my @args = split /\t/;
+		@args > 2 or next;
+		$seen{"$args[0]/$args[1]"}++ and next;
+		-f "$args[0]/$args[1]" and next;
+		push @pending, \@args;
+	}
+	close QUEUE;
+	unlink $queue;
+
+	@pending or exit 0;
+	print("Prefetching ".scalar(@pending)." files, $jobs at a time\n");
+
+	# keep the output of the parallel downloads readable
+	$ENV{WGET_OPTIONS} = ($ENV{WGET_OPTIONS} || "")." -nv";
+
+	while (@pending or %running) {
+		while (@pending and keys(%running) < $jobs) {
+			my $args = shift @pending;
+			my $pid = fork();
+
+			defined $pid or die "Cannot fork: $!\n";
+			$pid or exec($^X, $0, @$args) or exit 1;
+			$running{$pid} = $args->[1];
+		}
+
+		my $pid = wait();
+		$pid > 0 or last;
+		my $file = delete $running{$pid};
+		defined $file or next;
+		if ($?) {
+			print STDERR "Prefetching $file failed.\n";
+			$failed++;
+		} else {
+			$done++;
+		}
+	}
+
+	print("Prefetched $done files".($failed ? ", $failed failed" : "")."\n");
+	exit 0;
+}
+
+cache_fetch() and exit 0;
+
+if ($queue) {
+	enqueue();
+	exit 0;
 }
 
 @mirrors = localmirrors();
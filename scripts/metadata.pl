@@ -367,29 +367,34 @@ EOF
 	}
 }
 
-my %dep_check;
-sub __find_package_dep($$) {
+# transitive closure of the names reachable through (v)depends, computed
+# once per package since the menu sort compares every pair
+my %dep_closure;
+sub package_dep_closure($) {
 	my $pkg = shift;
-	my $name = shift;
-	my $deps = ($pkg->{vdepends} or $pkg->{depends});
-
-	return 0 unless defined $deps;
-	foreach my $dep (@{$deps}) {
-		next if $dep_check{$dep};
-		$dep_check{$dep} = 1;
-		return 1 if $dep eq $name;
-		return 1 if ($package{$dep} and (__find_package_dep($package{$dep},$name) == 1));
+	my $closure = $dep_closure{$pkg};
+
+	return $closure if $closure;
+	$closure = {};
+	my @stack = ($pkg);
+	while (my $cur = pop @stack) {
+		my $deps = ($cur->{vdepends} or $cur->{depends});
+		next unless defined $deps;
+		foreach my $dep (@{$deps}) {
+			next if $closure->{$dep};
+			$closure->{$dep} = 1;
+			$package{$dep} and push @stack, $package{$dep};
+		}
 	}
-	return 0;
+	$dep_closure{$pkg} = $closure;
+	return $closure;
 }
 
-# wrapper to avoid infinite recursion
 sub find_package_dep($$) {
 	my $pkg = shift;
 	my $name = shift;
 
-	%dep_check = ();
-	return __find_package_dep($pkg, $name);
+	return package_dep_closure($pkg)->{$name} ? 1 : 0;
 }
 
 sub package_depends($$) {
@@ -408,6 +413,26 @@ sub package_depends($$) {
 	return $ret;
 }
 
+# split a dependency token into flags, condition and name once
+my %dep_token;
+sub parse_dep_token($) {
+	my $token = shift;
+	my $res = $dep_token{$token};
+
+	return $res if $res;
+	my $depend = $token;
+	my $flags = "";
+	my ($cond, $name);
+	$depend =~ s/^([@\+]+)// and $flags = $1;
+	if ($depend =~ /^(.+):(.+)$/) {
+		$cond = $1;
+		$name = $2;
+	}
+	$res = [ $flags, $depend, $cond, $name ];
+	$dep_token{$token} = $res;
+	return $res;
+}
+
 sub mconf_depends {
 	my $pkgname = shift;
 	my $depends = shift;
@@ -420,12 +445,10 @@ sub mconf_depends {
 	$seen or $seen = {};
 	my @t_depends;
 
-	$depends or return;
-	my @depends = @$depends;
-	foreach my $depend (@depends) {
+	$depends and @$depends or return;
+	foreach my $token (@$depends) {
 		my $m = "depends on";
-		my $flags = "";
-		$depend =~ s/^([@\+]+)// and $flags = $1;
+		my ($flags, $depend, $cond, $name) = @{parse_dep_token($token)};
 		my $vdep;
 		my $condition = $parent_condition;
 
@@ -433,15 +456,15 @@ sub mconf_depends {
 		next if $seen->{"$parent_condition:$depend"};
 		next if $seen->{":$depend"};
 		$seen->{"$parent_condition:$depend"} = 1;
-		if ($depend =~ /^(.+):(.+)$/) {
-			if ($1 ne "PACKAGE_$pkgname") {
+		if (defined $name) {
+			if ($cond ne "PACKAGE_$pkgname") {
 				if ($condition) {
-					$condition = "$condition && $1";
+					$condition = "$condition && $cond";
 				} else {
-					$condition = $1;
+					$condition = $cond;
 				}
 			}
-			$depend = $2;
+			$depend = $name;
 		}
 		next if $package{$depend} and $package{$depend}->{buildonly};
 		if ($vdep = $package{$depend}->{vdepends}) {
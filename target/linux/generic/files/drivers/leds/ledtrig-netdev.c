@@ -20,6 +20,7 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
 #include <linux/spinlock.h>
 #include <linux/device.h>
 #include <linux/sysdev.h>
@@ -42,6 +43,9 @@
  *   tx:   LED blinks on transmitted data
  *   rx:   LED blinks on receive data
  *
+ * All LEDs watching the same device share a single deferrable poller, which
+ * is stopped while the link is down and slows down while the link is quiet.
+ *
  * Some suggestions:
  *
  *  Simple link status LED:
@@ -68,33 +72,251 @@
 #define MODE_TX   2
 #define MODE_RX   4
 
-struct led_netdev_data {
-	rwlock_t lock;
+/* after this many quiet polls the poll period doubles, up to IDLE_PERIOD */
+#define IDLE_POLLS  10
+#define IDLE_PERIOD msecs_to_jiffies(500)
+
+/* state shared by all LEDs watching one net device */
+struct led_netdev_dev {
+	struct list_head list;
+	struct list_head leds;
+	spinlock_t lock;
 
 	struct timer_list timer;
-	struct notifier_block notifier;
 
-	struct led_classdev *led_cdev;
 	struct net_device *net_dev;
 
+	char device_name[IFNAMSIZ];
+	unsigned link_up;
+	unsigned long interval;
+	unsigned long period;
+	unsigned idle;
+	unsigned long tx_packets;
+	unsigned long rx_packets;
+};
+
+struct led_netdev_data {
+	struct list_head list;
+	struct led_netdev_dev *nd;
+
+	struct led_classdev *led_cdev;
+
 	char device_name[IFNAMSIZ];
 	unsigned interval;
 	unsigned mode;
-	unsigned link_up;
-	unsigned last_activity;
+	unsigned long last_activity;
+	unsigned long next;
 };
 
+static LIST_HEAD(netdev_trig_devs);
+static DEFINE_MUTEX(netdev_trig_mutex);
+
+static unsigned long netdev_trig_activity(struct led_netdev_data *trigger_data)
+{
+	struct led_netdev_dev *nd = trigger_data->nd;
+
+	return ((trigger_data->mode & MODE_TX) ? nd->tx_packets : 0) +
+	       ((trigger_data->mode & MODE_RX) ? nd->rx_packets : 0);
+}
+
 static void set_baseline_state(struct led_netdev_data *trigger_data)
 {
-	if ((trigger_data->mode & MODE_LINK) != 0 && trigger_data->link_up)
+	struct led_netdev_dev *nd = trigger_data->nd;
+
+	if ((trigger_data->mode & MODE_LINK) != 0 && nd && nd->link_up)
 		led_set_brightness(trigger_data->led_cdev, LED_FULL);
 	else
 		led_set_brightness(trigger_data->led_cdev, LED_OFF);
+}
 
-	if ((trigger_data->mode & (MODE_TX | MODE_RX)) != 0 && trigger_data->link_up)
-		mod_timer(&trigger_data->timer, jiffies + trigger_data->interval);
-	else
-		del_timer(&trigger_data->timer);
+/* resets the LEDs of a device and starts or stops its poller, nd->lock held */
+static void netdev_trig_dev_update(struct led_netdev_dev *nd)
+{
+	struct led_netdev_data *trigger_data;
+
+	nd->interval = 0;
+
+	list_for_each_entry(trigger_data, &nd->leds, list) {
+		set_baseline_state(trigger_data);
+
+		if ((trigger_data->mode & (MODE_TX | MODE_RX)) == 0)
+			continue;
+
+		trigger_data->last_activity = netdev_trig_activity(trigger_data);
+		trigger_data->next = jiffies;
+
+		if (!nd->interval || trigger_data->interval < nd->interval)
+			nd->interval = trigger_data->interval;
+	}
+
+	if (nd->interval && nd->link_up && nd->net_dev) {
+		nd->period = nd->interval;
+		nd->idle = 0;
+		mod_timer(&nd->timer, jiffies + nd->period);
+	} else {
+		del_timer(&nd->timer);
+	}
+}
+
+/* takes the locks protecting the settings of trigger_data */
+static void netdev_trig_lock(struct led_netdev_data *trigger_data)
+{
+	mutex_lock(&netdev_trig_mutex);
+	if (trigger_data->nd)
+		spin_lock_bh(&trigger_data->nd->lock);
+}
+
+/* applies the changed settings of trigger_data and drops the locks */
+static void netdev_trig_unlock(struct led_netdev_data *trigger_data)
+{
+	struct led_netdev_dev *nd = trigger_data->nd;
+
+	if (nd) {
+		netdev_trig_dev_update(nd);
+		spin_unlock_bh(&nd->lock);
+	} else {
+		set_baseline_state(trigger_data);
+	}
+	mutex_unlock(&netdev_trig_mutex);
+}
+
+/* here's the real work! */
+static void netdev_trig_timer(unsigned long arg)
+{
+	struct led_netdev_dev *nd = (struct led_netdev_dev *)arg;
+	struct led_netdev_data *trigger_data;
+	const struct net_device_stats *dev_stats;
+	unsigned long new_activity;
+	int active;
+
+	spin_lock(&nd->lock);
+
+	/* link went down or nothing to blink, netdev_trig_dev_update() already set the LEDs */
+	if (!nd->interval || !nd->link_up || !nd->net_dev)
+		goto no_restart;
+
+	dev_stats = dev_get_stats(nd->net_dev);
+	active = (nd->tx_packets != dev_stats->tx_packets ||
+		  nd->rx_packets != dev_stats->rx_packets);
+	nd->tx_packets = dev_stats->tx_packets;
+	nd->rx_packets = dev_stats->rx_packets;
+
+	list_for_each_entry(trigger_data, &nd->leds, list) {
+		if ((trigger_data->mode & (MODE_TX | MODE_RX)) == 0 ||
+		    time_before(jiffies, trigger_data->next))
+			continue;
+
+		new_activity = netdev_trig_activity(trigger_data);
+
+		if (trigger_data->mode & MODE_LINK) {
+			/* base state is ON (link present) */
+			/* if there's no link, we don't get this far and the LED is off */
+
+			/* OFF -> ON always */
+			/* ON -> OFF on activity */
+			if (trigger_data->led_cdev->brightness == LED_OFF) {
+				led_set_brightness(trigger_data->led_cdev, LED_FULL);
+			} else if (trigger_data->last_activity != new_activity) {
+				led_set_brightness(trigger_data->led_cdev, LED_OFF);
+			}
+		} else {
+			/* base state is OFF */
+			/* ON -> OFF always */
+			/* OFF -> ON on activity */
+			if (trigger_data->led_cdev->brightness == LED_FULL) {
+				led_set_brightness(trigger_data->led_cdev, LED_OFF);
+			} else if (trigger_data->last_activity != new_activity) {
+				led_set_brightness(trigger_data->led_cdev, LED_FULL);
+			}
+		}
+
+		trigger_data->last_activity = new_activity;
+		trigger_data->next = jiffies + trigger_data->interval;
+	}
+
+	/* a quiet link has its LEDs back in the base state, poll it less often */
+	if (active) {
+		nd->idle = 0;
+		nd->period = nd->interval;
+	} else if (++nd->idle > IDLE_POLLS && nd->period < IDLE_PERIOD) {
+		nd->period = min(nd->period * 2, max(nd->interval, IDLE_PERIOD));
+	}
+
+	mod_timer(&nd->timer, jiffies + nd->period);
+
+no_restart:
+	spin_unlock(&nd->lock);
+}
+
+/* finds or creates the shared state for a device name, netdev_trig_mutex held */
+static struct led_netdev_dev *netdev_trig_dev_get(const char *name)
+{
+	struct led_netdev_dev *nd;
+
+	list_for_each_entry(nd, &netdev_trig_devs, list)
+		if (!strcmp(nd->device_name, name))
+			return nd;
+
+	nd = kzalloc(sizeof(struct led_netdev_dev), GFP_KERNEL);
+	if (!nd)
+		return NULL;
+
+	INIT_LIST_HEAD(&nd->leds);
+	spin_lock_init(&nd->lock);
+
+	init_timer_deferrable(&nd->timer);
+	nd->timer.function = netdev_trig_timer;
+	nd->timer.data = (unsigned long) nd;
+
+	strcpy(nd->device_name, name);
+
+	/* check for existing device to update from */
+	nd->net_dev = dev_get_by_name(&init_net, nd->device_name);
+	if (nd->net_dev != NULL)
+		nd->link_up = (dev_get_flags(nd->net_dev) & IFF_LOWER_UP) != 0;
+
+	list_add(&nd->list, &netdev_trig_devs);
+	return nd;
+}
+
+static int netdev_trig_attach(struct led_netdev_data *trigger_data)
+{
+	struct led_netdev_dev *nd;
+
+	nd = netdev_trig_dev_get(trigger_data->device_name);
+	if (!nd)
+		return -ENOMEM;
+
+	spin_lock_bh(&nd->lock);
+	trigger_data->nd = nd;
+	list_add_tail(&trigger_data->list, &nd->leds);
+	netdev_trig_dev_update(nd); /* updates LEDs, may start the timer */
+	spin_unlock_bh(&nd->lock);
+
+	return 0;
+}
+
+static void netdev_trig_detach(struct led_netdev_data *trigger_data)
+{
+	struct led_netdev_dev *nd = trigger_data->nd;
+
+	if (!nd)
+		return;
+
+	spin_lock_bh(&nd->lock);
+	list_del(&trigger_data->list);
+	trigger_data->nd = NULL;
+	netdev_trig_dev_update(nd);
+	spin_unlock_bh(&nd->lock);
+
+	if (!list_empty(&nd->leds))
+		return;
+
+	list_del(&nd->list);
+	del_timer_sync(&nd->timer);
+	if (nd->net_dev)
+		dev_put(nd->net_dev);
+	kfree(nd);
 }
 
 static ssize_t led_device_name_show(struct device *dev,
@@ -103,9 +325,9 @@ static ssize_t led_device_name_show(struct device *dev,
 	struct led_classdev *led_cdev = dev_get_drvdata(dev);
 	struct led_netdev_data *trigger_data = led_cdev->trigger_data;
 
-	read_lock(&trigger_data->lock);
+	mutex_lock(&netdev_trig_mutex);
 	sprintf(buf, "%s\n", trigger_data->device_name);
-	read_unlock(&trigger_data->lock);
+	mutex_unlock(&netdev_trig_mutex);
 
 	return strlen(buf) + 1;
 }
@@ -115,26 +337,24 @@ static ssize_t led_device_name_store(struct device *dev,
 {
 	struct led_classdev *led_cdev = dev_get_drvdata(dev);
 	struct led_netdev_data *trigger_data = led_cdev->trigger_data;
+	int ret = 0;
 
 	if (size < 0 || size >= IFNAMSIZ)
 		return -EINVAL;
 
-	write_lock(&trigger_data->lock);
+	mutex_lock(&netdev_trig_mutex);
+
+	netdev_trig_detach(trigger_data);
 
 	strcpy(trigger_data->device_name, buf);
 	if (size > 0 && trigger_data->device_name[size-1] == '\n')
 		trigger_data->device_name[size-1] = 0;
 
-	if (trigger_data->device_name[0] != 0) {
-		/* check for existing device to update from */
-		trigger_data->net_dev = dev_get_by_name(&init_net, trigger_data->device_name);
-		if (trigger_data->net_dev != NULL)
-			trigger_data->link_up = (dev_get_flags(trigger_data->net_dev) & IFF_LOWER_UP) != 0;
-		set_baseline_state(trigger_data); /* updates LEDs, may start timers */
-	}
+	if (trigger_data->device_name[0] != 0)
+		ret = netdev_trig_attach(trigger_data);
 
-	write_unlock(&trigger_data->lock);
-	return size;
+	mutex_unlock(&netdev_trig_mutex);
+	return ret ? ret : size;
 }
 
 static DEVICE_ATTR(device_name, 0644, led_device_name_show, led_device_name_store);
@@ -145,7 +365,7 @@ static ssize_t led_mode_show(struct device *dev,
 	struct led_classdev *led_cdev = dev_get_drvdata(dev);
 	struct led_netdev_data *trigger_data = led_cdev->trigger_data;
 
-	read_lock(&trigger_data->lock);
+	mutex_lock(&netdev_trig_mutex);
 
 	if (trigger_data->mode == 0) {
 		strcpy(buf, "none\n");
@@ -159,7 +379,7 @@ static ssize_t led_mode_show(struct device *dev,
 		strcat(buf, "\n");
 	}
 
-	read_unlock(&trigger_data->lock);
+	mutex_unlock(&netdev_trig_mutex);
 
 	return strlen(buf)+1;
 }
@@ -200,10 +420,9 @@ static ssize_t led_mode_store(struct device *dev,
 	if (new_mode == -1)
 		return -EINVAL;
 
-	write_lock(&trigger_data->lock);
+	netdev_trig_lock(trigger_data);
 	trigger_data->mode = new_mode;
-	set_baseline_state(trigger_data);
-	write_unlock(&trigger_data->lock);
+	netdev_trig_unlock(trigger_data);
 
 	return size;
 }
@@ -216,9 +435,9 @@ static ssize_t led_interval_show(struct device *dev,
 	struct led_classdev *led_cdev = dev_get_drvdata(dev);
 	struct led_netdev_data *trigger_data = led_cdev->trigger_data;
 
-	read_lock(&trigger_data->lock);
+	mutex_lock(&netdev_trig_mutex);
 	sprintf(buf, "%u\n", jiffies_to_msecs(trigger_data->interval));
-	read_unlock(&trigger_data->lock);
+	mutex_unlock(&netdev_trig_mutex);
 
 	return strlen(buf) + 1;
 }
@@ -238,10 +457,9 @@ static ssize_t led_interval_store(struct device *dev,
 
 	/* impose some basic bounds on the timer interval */
 	if (count == size && value >= 5 && value <= 10000) {
-		write_lock(&trigger_data->lock);
+		netdev_trig_lock(trigger_data);
 		trigger_data->interval = msecs_to_jiffies(value);
-		set_baseline_state(trigger_data); /* resets timer */
-		write_unlock(&trigger_data->lock);
+		netdev_trig_unlock(trigger_data); /* resets timer */
 		ret = count;
 	}
 
@@ -255,89 +473,47 @@ static int netdev_trig_notify(struct notifier_block *nb,
 			      void *dv)
 {
 	struct net_device *dev = dv;
-	struct led_netdev_data *trigger_data = container_of(nb, struct led_netdev_data, notifier);
+	struct led_netdev_dev *nd;
 
 	if (evt != NETDEV_UP && evt != NETDEV_DOWN && evt != NETDEV_CHANGE && evt != NETDEV_REGISTER && evt != NETDEV_UNREGISTER)
 		return NOTIFY_DONE;
 
-	write_lock(&trigger_data->lock);
+	mutex_lock(&netdev_trig_mutex);
 
-	if (strcmp(dev->name, trigger_data->device_name))
-		goto done;
+	list_for_each_entry(nd, &netdev_trig_devs, list) {
+		if (strcmp(dev->name, nd->device_name))
+			continue;
 
-	if (evt == NETDEV_REGISTER) {
-		if (trigger_data->net_dev != NULL)
-			dev_put(trigger_data->net_dev);
-		dev_hold(dev);
-		trigger_data->net_dev = dev;
-		trigger_data->link_up = 0;
-		goto done;
-	}
+		spin_lock_bh(&nd->lock);
+
+		if (evt == NETDEV_REGISTER) {
+			if (nd->net_dev != NULL)
+				dev_put(nd->net_dev);
+			dev_hold(dev);
+			nd->net_dev = dev;
+			nd->link_up = 0;
+		} else if (evt == NETDEV_UNREGISTER) {
+			if (nd->net_dev != NULL)
+				dev_put(nd->net_dev);
+			nd->net_dev = NULL;
+		} else {
+			/* UP / DOWN / CHANGE */
+			nd->link_up = (evt != NETDEV_DOWN && netif_carrier_ok(dev));
+		}
 
-	if (evt == NETDEV_UNREGISTER && trigger_data->net_dev != NULL) {
-		dev_put(trigger_data->net_dev);
-		trigger_data->net_dev = NULL;
-		goto done;
+		netdev_trig_dev_update(nd);
+		spin_unlock_bh(&nd->lock);
+		break;
 	}
 
-	/* UP / DOWN / CHANGE */
-
-	trigger_data->link_up = (evt != NETDEV_DOWN && netif_carrier_ok(dev));
-	set_baseline_state(trigger_data);
-
-done:
-	write_unlock(&trigger_data->lock);
+	mutex_unlock(&netdev_trig_mutex);
 	return NOTIFY_DONE;
 }
 
-/* here's the real work! */
-static void netdev_trig_timer(unsigned long arg)
-{
-	struct led_netdev_data *trigger_data = (struct led_netdev_data *)arg;
-	const struct net_device_stats *dev_stats;
-	unsigned new_activity;
-
-	write_lock(&trigger_data->lock);
-
-	if (!trigger_data->link_up || !trigger_data->net_dev || (trigger_data->mode & (MODE_TX | MODE_RX)) == 0) {
-		/* we don't need to do timer work, just reflect link state. */
-		led_set_brightness(trigger_data->led_cdev, ((trigger_data->mode & MODE_LINK) != 0 && trigger_data->link_up) ? LED_FULL : LED_OFF);
-		goto no_restart;
-	}
-
-	dev_stats = dev_get_stats(trigger_data->net_dev);
-	new_activity =
-		((trigger_data->mode & MODE_TX) ? dev_stats->tx_packets : 0) +
-		((trigger_data->mode & MODE_RX) ? dev_stats->rx_packets : 0);
-
-	if (trigger_data->mode & MODE_LINK) {
-		/* base state is ON (link present) */
-		/* if there's no link, we don't get this far and the LED is off */
-
-		/* OFF -> ON always */
-		/* ON -> OFF on activity */
-		if (trigger_data->led_cdev->brightness == LED_OFF) {
-			led_set_brightness(trigger_data->led_cdev, LED_FULL);
-		} else if (trigger_data->last_activity != new_activity) {
-			led_set_brightness(trigger_data->led_cdev, LED_OFF);
-		}
-	} else {
-		/* base state is OFF */
-		/* ON -> OFF always */
-		/* OFF -> ON on activity */
-		if (trigger_data->led_cdev->brightness == LED_FULL) {
-			led_set_brightness(trigger_data->led_cdev, LED_OFF);
-		} else if (trigger_data->last_activity != new_activity) {
-			led_set_brightness(trigger_data->led_cdev, LED_FULL);
-		}
-	}
-
-	trigger_data->last_activity = new_activity;
-	mod_timer(&trigger_data->timer, jiffies + trigger_data->interval);
-
-no_restart:
-	write_unlock(&trigger_data->lock);
-}
+static struct notifier_block netdev_trig_notifier = {
+	.notifier_call = netdev_trig_notify,
+	.priority = 10,
+};
 
 static void netdev_trig_activate(struct led_classdev *led_cdev)
 {
@@ -348,20 +524,14 @@ static void netdev_trig_activate(struct led_classdev *led_cdev)
 	if (!trigger_data)
 		return;
 
-	rwlock_init(&trigger_data->lock);
-
-	trigger_data->notifier.notifier_call = netdev_trig_notify;
-	trigger_data->notifier.priority = 10;
-
-	setup_timer(&trigger_data->timer, netdev_trig_timer, (unsigned long) trigger_data);
+	INIT_LIST_HEAD(&trigger_data->list);
 
 	trigger_data->led_cdev = led_cdev;
-	trigger_data->net_dev = NULL;
+	trigger_data->nd = NULL;
 	trigger_data->device_name[0] = 0;
 
 	trigger_data->mode = 0;
 	trigger_data->interval = msecs_to_jiffies(50);
-	trigger_data->link_up = 0;
 	trigger_data->last_activity = 0;
 
 	led_cdev->trigger_data = trigger_data;
@@ -376,7 +546,6 @@ static void netdev_trig_activate(struct led_classdev *led_cdev)
 	if (rc)
 		goto err_out_mode;
 
-	register_netdevice_notifier(&trigger_data->notifier);
 	return;
 
 err_out_mode:
@@ -393,22 +562,13 @@ static void netdev_trig_deactivate(struct led_classdev *led_cdev)
 	struct led_netdev_data *trigger_data = led_cdev->trigger_data;
 
 	if (trigger_data) {
-		unregister_netdevice_notifier(&trigger_data->notifier);
-
 		device_remove_file(led_cdev->dev, &dev_attr_device_name);
 		device_remove_file(led_cdev->dev, &dev_attr_mode);
 		device_remove_file(led_cdev->dev, &dev_attr_interval);
 
-		write_lock(&trigger_data->lock);
-
-		if (trigger_data->net_dev) {
-			dev_put(trigger_data->net_dev);
-			trigger_data->net_dev = NULL;
-		}
-
-		write_unlock(&trigger_data->lock);
-
-		del_timer_sync(&trigger_data->timer);
+		mutex_lock(&netdev_trig_mutex);
+		netdev_trig_detach(trigger_data);
+		mutex_unlock(&netdev_trig_mutex);
 
 		kfree(trigger_data);
 	}
@@ -422,12 +582,23 @@ static struct led_trigger netdev_led_trigger = {
 
 static int __init netdev_trig_init(void)
 {
-	return led_trigger_register(&netdev_led_trigger);
+	int rc;
+
+	rc = register_netdevice_notifier(&netdev_trig_notifier);
+	if (rc)
+		return rc;
+
+	rc = led_trigger_register(&netdev_led_trigger);
+	if (rc)
+		unregister_netdevice_notifier(&netdev_trig_notifier);
+
+	return rc;
 }
 
 static void __exit netdev_trig_exit(void)
 {
 	led_trigger_unregister(&netdev_led_trigger);
+	unregister_netdevice_notifier(&netdev_trig_notifier);
 }
 
 module_init(netdev_trig_init);
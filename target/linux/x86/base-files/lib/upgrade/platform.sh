@@ -34,11 +34,21 @@ platform_copy_config() {
 	umount /mnt
 }
 
+RAMFS_COPY_BIN="$RAMFS_COPY_BIN /usr/sbin/blkwrite"
+
 platform_do_upgrade() {
 	local rootfs="$(x86_get_rootfs)"
 	local rootfsdev="${rootfs##*:}"
+	local disk="${rootfsdev%[0-9]}"
 
 	sync
-	[ -b ${rootfsdev%[0-9]} ] && get_image "$@" | dd of=${rootfsdev%[0-9]} bs=4096 conv=fsync
+	[ -b $disk ] || return
+
+	# only write what differs from the installed image
+	if [ -x /usr/sbin/blkwrite ]; then
+		get_image "$@" | /usr/sbin/blkwrite $disk
+	else
+		get_image "$@" | dd of=$disk bs=4096 conv=fsync
+	fi
 	sleep 1
 }
@@ -19,21 +19,25 @@ head=16
 sect=63
 cyl=$(( ($KERNELSIZE + $ROOTFSSIZE) * 1024 * 1024 / ($head * $sect * 512)))
 
-# create partition table
-set `ptgen -o "$OUTPUT" -h $head -s $sect -p ${KERNELSIZE}m -p ${ROOTFSSIZE}m ${ALIGN:+-l $ALIGN}`
-
-KERNELOFFSET="$(($1 / 512))"
-KERNELSIZE="$(($2 / 512))"
-ROOTFSOFFSET="$(($3 / 512))"
-ROOTFSSIZE="$(($4 / 512))"
-
-BLOCKS="$((($KERNELSIZE / 2) - 1))"
+# the kernel partition holds an ext2 filesystem with the boot files
+KERNELIMAGE=
+[ -n "$NOGRUB" ] || {
+	# the partition size is rounded up to whole cylinders or the alignment
+	set `ptgen -o "$OUTPUT" -h $head -s $sect -p ${KERNELSIZE}m -p ${ROOTFSSIZE}m ${ALIGN:+-l $ALIGN}`
+	BLOCKS="$((($2 / 1024) - 1))"
+
+	KERNELIMAGE="$OUTPUT.kernel"
+	genext2fs -d "$KERNELDIR" -b "$BLOCKS" "$KERNELIMAGE"
+}
 
-[ -n "$PADDING" ] && dd if=/dev/zero of="$OUTPUT" bs=512 seek="$ROOTFSOFFSET" conv=notrunc count="$ROOTFSSIZE"
-dd if="$ROOTFSIMAGE" of="$OUTPUT" bs=512 seek="$ROOTFSOFFSET" conv=notrunc
+# without padding the image ends with the rootfs data
+NOPAD=-n
+[ -n "$PADDING" ] && NOPAD=
 
-[ -n "$NOGRUB" ] && exit 0
+# create partition table and copy the filesystems into their partitions,
+# leaving unused space sparse
+ptgen -o "$OUTPUT" -h $head -s $sect $NOPAD ${KERNELIMAGE:+-f "$KERNELIMAGE"} -p ${KERNELSIZE}m -f "$ROOTFSIMAGE" -p ${ROOTFSSIZE}m ${ALIGN:+-l $ALIGN} > /dev/null
+RET=$?
 
-genext2fs -d "$KERNELDIR" -b "$BLOCKS" "$OUTPUT.kernel"
-dd if="$OUTPUT.kernel" of="$OUTPUT" bs=512 seek="$KERNELOFFSET" conv=notrunc
 rm -f "$OUTPUT.kernel"
+exit $RET
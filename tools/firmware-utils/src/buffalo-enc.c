@@ -34,6 +34,7 @@ static unsigned char seed = 'O';
 static char *product;
 static char *version;
 static int do_decrypt;
+static int verify;
 
 void usage(int status)
 {
@@ -51,6 +52,7 @@ void usage(int status)
 "  -m <magic>      set magic to <magic>\n"
 "  -p <product>    set product name to <product>\n"
 "  -v <version>    set version to <version>\n"
+"  -T              verify the encrypted image by decrypting it again\n"
 "  -h              show this screen\n"
 	);
 
@@ -113,6 +115,40 @@ out:
 	return ret;
 }
 
+static int verify_buf(struct enc_param *ep, unsigned char *buf,
+		      ssize_t totlen)
+{
+	struct enc_param dp;
+	unsigned char *copy;
+	int ret = -1;
+
+	copy = malloc(totlen);
+	if (copy == NULL) {
+		ERR("no memory for the verification buffer");
+		return -1;
+	}
+	memcpy(copy, buf, totlen);
+
+	memset(&dp, '\0', sizeof(dp));
+	dp.key = ep->key;
+	dp.longstate = ep->longstate;
+
+	/* decrypt_buf() checks the data against the stored checksum */
+	if (decrypt_buf(&dp, copy, totlen) ||
+	    dp.datalen != ep->datalen || dp.csum != ep->csum ||
+	    strcmp((char *) dp.product, (char *) ep->product) ||
+	    strcmp((char *) dp.version, (char *) ep->version)) {
+		ERR("encrypted image does not decrypt to its input");
+		goto out;
+	}
+
+	ret = 0;
+
+out:
+	free(copy);
+	return ret;
+}
+
 static int encrypt_file(void)
 {
 	struct enc_param ep;
@@ -160,6 +196,12 @@ static int encrypt_file(void)
 		goto free_buf;
 	}
 
+	if (verify) {
+		err = verify_buf(&ep, buf, totlen);
+		if (err)
+			goto free_buf;
+	}
+
 	err = write_buf_to_file(ofname, buf, totlen);
 	if (err) {
 		ERR("unable to write to file '%s'", ofname);
@@ -239,7 +281,7 @@ int main(int argc, char *argv[])
 	while ( 1 ) {
 		int c;
 
-		c = getopt(argc, argv, "adi:m:o:hlp:v:k:r:s:");
+		c = getopt(argc, argv, "adi:m:o:hlp:v:k:r:s:T");
 		if (c == -1)
 			break;
 
@@ -271,6 +313,9 @@ int main(int argc, char *argv[])
 		case 's':
 			seed = strtoul(optarg, NULL, 16);
 			break;
+		case 'T':
+			verify = 1;
+			break;
 		case 'h':
 			usage(EXIT_SUCCESS);
 			break;
@@ -104,13 +104,25 @@ int bcrypt_init(struct bcrypt_ctx *ctx, void *key, int keylen,
 	for (i = 0; i < state_len; i++)
 		state[i] = i;
 
-	for(i = 0, j = 0; i < state_len; i++, j = (j + 1) % keylen) {
+	/*
+	 * The state is as large as the image with longstate, keep divisions
+	 * out of the loop: k + p[j] + t is less than state_len + 510.
+	 */
+	for(i = 0, j = 0; i < state_len; i++) {
 		unsigned char t;
 
 		t = state[i];
-		k = (k + p[j] + t) % state_len;
+		k += p[j] + t;
+		if (k >= state_len) {
+			k -= state_len;
+			if (k >= state_len)
+				k %= state_len;
+		}
 		state[i] = state[k];
 		state[k] = t;
+
+		if (++j == keylen)
+			j = 0;
 	}
 
 	return 0;
@@ -127,16 +139,49 @@ int bcrypt_process(struct bcrypt_ctx *ctx, unsigned char *src,
 	i = ctx->i;
 	j = ctx->j;
 
-	for (k = 0; k < len; k++) {
-		unsigned char t;
-
-		i = (i + 1) % state_len;
-		j = (j + state[i]) % state_len;
-		t = state[j];
-		state[j] = state[i];
-		state[i] = t;
-
-		dst[k] = src[k] ^ state[(state[i] + state[j]) % state_len];
+	/*
+	 * i and j are 8 bits wide, so with state_len > 510 none of the
+	 * reductions has any effect, and with a power of two up to 256 they
+	 * are a mask. Only other lengths need the division.
+	 */
+	if (state_len > 2 * 255) {
+		for (k = 0; k < len; k++) {
+			unsigned char t;
+
+			i++;
+			j += state[i];
+			t = state[j];
+			state[j] = state[i];
+			state[i] = t;
+
+			dst[k] = src[k] ^ state[state[i] + state[j]];
+		}
+	} else if ((state_len & (state_len - 1)) == 0) {
+		unsigned long mask = state_len - 1;
+
+		for (k = 0; k < len; k++) {
+			unsigned char t;
+
+			i = (i + 1) & mask;
+			j = (j + state[i]) & mask;
+			t = state[j];
+			state[j] = state[i];
+			state[i] = t;
+
+			dst[k] = src[k] ^ state[(state[i] + state[j]) & mask];
+		}
+	} else {
+		for (k = 0; k < len; k++) {
+			unsigned char t;
+
+			i = (i + 1) % state_len;
+			j = (j + state[i]) % state_len;
+			t = state[j];
+			state[j] = state[i];
+			state[i] = t;
+
+			dst[k] = src[k] ^ state[(state[i] + state[j]) % state_len];
+		}
 	}
 
 	ctx->i = i;
@@ -177,16 +222,38 @@ int bcrypt_buf(unsigned char seed, unsigned char *key, unsigned char *src,
 	return 0;
 }
 
+static uint32_t csum_table[256];
+
+static void init_csum_table(void)
+{
+	uint32_t c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c >> 1) ^ ((c & 1) ? 0xedb88320ul : 0);
+		csum_table[i] = c;
+	}
+}
+
 uint32_t buffalo_csum(uint32_t csum, void *buf, unsigned long len)
 {
-	char *p = buf;
+	unsigned char *p = buf;
+
+	if (!csum_table[1])
+		init_csum_table();
 
+	/*
+	 * Where char is signed, the bytes are sign extended before being
+	 * XORed in; the extension bits come out shifted down by 8.
+	 */
 	while (len--) {
-		int i;
+		unsigned char c = *p++;
 
-		csum ^= *p++;
-		for (i = 0; i < 8; i++)
-			csum = (csum >> 1) ^ ((csum & 1) ? 0xedb88320ul : 0);
+		csum = (csum >> 8) ^ csum_table[(csum ^ c) & 0xff];
+		if ((char) c < 0)
+			csum ^= 0x00ffffff;
 	}
 
 	return csum;
@@ -0,0 +1,349 @@
+/*
+ * Helpers for assembling firmware images without copying the input files
+ *
+ * Copyright (C) 2015 OpenWrt.org
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "fwimage.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX		1024
+#endif
+
+#define FILL_BUF_SIZE	(64 * 1024)
+
+static uint8_t *fill_buf[256];
+
+static const uint8_t *get_fill_buf(uint8_t fill)
+{
+	if (!fill_buf[fill]) {
+		fill_buf[fill] = malloc(FILL_BUF_SIZE);
+		if (!fill_buf[fill])
+			return NULL;
+
+		memset(fill_buf[fill], fill, FILL_BUF_SIZE);
+	}
+
+	return fill_buf[fill];
+}
+
+static int read_whole(struct fwimage_file *f, int fd)
+{
+	size_t size = 0;
+	ssize_t n;
+
+	f->size = 0;
+	f->data = NULL;
+
+	do {
+		if (f->size == size) {
+			uint8_t *p;
+
+			size = size ? size * 2 : FILL_BUF_SIZE;
+			p = realloc(f->data, size);
+			if (!p) {
+				errno = ENOMEM;
+				return -1;
+			}
+			f->data = p;
+		}
+
+		n = read(fd, f->data + f->size, size - f->size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		f->size += n;
+	} while (n > 0);
+
+	return 0;
+}
+
+int fwimage_map(struct fwimage_file *f, const char *name)
+{
+	struct stat st;
+	void *p;
+	int fd;
+	int err;
+
+	memset(f, 0, sizeof(*f));
+	f->name = name;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0)
+		goto err;
+
+	if (fstat(fd, &st))
+		goto err_close;
+
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+			 fd, 0);
+		if (p != MAP_FAILED) {
+			f->data = p;
+			f->size = st.st_size;
+			f->mapped = 1;
+			close(fd);
+			return 0;
+		}
+	}
+
+	if (read_whole(f, fd))
+		goto err_free;
+
+	close(fd);
+	return 0;
+
+err_free:
+	free(f->data);
+	f->data = NULL;
+err_close:
+	err = errno;
+	close(fd);
+	errno = err;
+err:
+	return -1;
+}
+
+void fwimage_unmap(struct fwimage_file *f)
+{
+	if (f->mapped)
+		munmap(f->data, f->size);
+	else
+		free(f->data);
+
+	f->data = NULL;
+	f->size = 0;
+	f->mapped = 0;
+}
+
+void fwimage_init(struct fwimage *img)
+{
+	memset(img, 0, sizeof(*img));
+}
+
+void fwimage_free(struct fwimage *img)
+{
+	free(img->seg);
+	fwimage_init(img);
+}
+
+static int add_seg(struct fwimage *img, const void *data, uint8_t fill,
+		   size_t len)
+{
+	struct fwimage_seg *seg;
+
+	if (!len)
+		return 0;
+
+	/* merge adjacent runs of the same fill byte */
+	if (!data && img->nseg) {
+		seg = &img->seg[img->nseg - 1];
+		if (!seg->data && seg->fill == fill) {
+			seg->len += len;
+			img->size += len;
+			return 0;
+		}
+	}
+
+	if (img->nseg == img->maxseg) {
+		int max = img->maxseg ? img->maxseg * 2 : 16;
+
+		seg = realloc(img->seg, max * sizeof(*seg));
+		if (!seg) {
+			errno = ENOMEM;
+			return -1;
+		}
+		img->seg = seg;
+		img->maxseg = max;
+	}
+
+	seg = &img->seg[img->nseg++];
+	seg->data = data;
+	seg->len = len;
+	seg->fill = fill;
+	img->size += len;
+
+	return 0;
+}
+
+int fwimage_add(struct fwimage *img, const void *data, size_t len)
+{
+	return add_seg(img, data, 0, len);
+}
+
+int fwimage_fill(struct fwimage *img, uint8_t fill, size_t len)
+{
+	return add_seg(img, NULL, fill, len);
+}
+
+int fwimage_fill_to(struct fwimage *img, uint8_t fill, size_t offset)
+{
+	if (offset < img->size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return add_seg(img, NULL, fill, offset - img->size);
+}
+
+int fwimage_walk(const struct fwimage *img, size_t offset, size_t len,
+		 fwimage_walk_fn fn, void *ctx)
+{
+	const struct fwimage_seg *seg;
+	size_t pos = 0;
+	int i;
+
+	if (offset > img->size || len > img->size - offset) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < img->nseg && len; i++) {
+		size_t skip, n;
+
+		seg = &img->seg[i];
+		if (pos + seg->len <= offset) {
+			pos += seg->len;
+			continue;
+		}
+
+		skip = offset > pos ? offset - pos : 0;
+		n = seg->len - skip;
+		if (n > len)
+			n = len;
+
+		pos += seg->len;
+		len -= n;
+
+		if (seg->data) {
+			fn(ctx, seg->data + skip, n);
+			continue;
+		}
+
+		while (n) {
+			const uint8_t *buf = get_fill_buf(seg->fill);
+			size_t chunk = n < FILL_BUF_SIZE ? n : FILL_BUF_SIZE;
+
+			if (!buf) {
+				errno = ENOMEM;
+				return -1;
+			}
+
+			fn(ctx, buf, chunk);
+			n -= chunk;
+		}
+	}
+
+	return 0;
+}
+
+struct write_ctx {
+	struct iovec	iov[IOV_MAX];
+	int		niov;
+	int		fd;
+	int		err;
+};
+
+static int flush_iov(struct write_ctx *w)
+{
+	struct iovec *iov = w->iov;
+	int niov = w->niov;
+	ssize_t n;
+
+	w->niov = 0;
+
+	while (niov) {
+		n = writev(w->fd, iov, niov);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		/* skip over what has been written by a short write */
+		while (niov && (size_t) n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			niov--;
+		}
+
+		if (niov) {
+			iov->iov_base = (uint8_t *) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+
+	return 0;
+}
+
+static void write_cb(void *ctx, const uint8_t *data, size_t len)
+{
+	struct write_ctx *w = ctx;
+
+	if (w->err)
+		return;
+
+	w->iov[w->niov].iov_base = (void *) data;
+	w->iov[w->niov].iov_len = len;
+
+	if (++w->niov == IOV_MAX && flush_iov(w))
+		w->err = errno;
+}
+
+int fwimage_write(const struct fwimage *img, const char *name)
+{
+	struct write_ctx *w;
+	int err = 0;
+
+	w = calloc(1, sizeof(*w));
+	if (!w) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	w->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w->fd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	if (fwimage_walk(img, 0, img->size, write_cb, w))
+		err = errno;
+	else if (w->err)
+		err = w->err;
+	else if (flush_iov(w))
+		err = errno;
+
+	if (close(w->fd) && !err)
+		err = errno;
+
+	if (err)
+		unlink(name);
+
+out:
+	free(w);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
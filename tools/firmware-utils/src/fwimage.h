@@ -0,0 +1,117 @@
+/*
+ * Helpers for assembling firmware images without copying the input files
+ *
+ * Copyright (C) 2015 OpenWrt.org
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ *
+ */
+
+#ifndef _FWIMAGE_H
+#define _FWIMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * An input file, mapped private and writable so that callers can patch
+ * it in place without touching the file itself. Files which cannot be
+ * mapped (pipes) are read into memory instead.
+ */
+struct fwimage_file {
+	const char	*name;
+	uint8_t		*data;
+	size_t		size;
+	int		mapped;
+};
+
+int fwimage_map(struct fwimage_file *f, const char *name);
+void fwimage_unmap(struct fwimage_file *f);
+
+/*
+ * An output image is a list of segments which either point to caller
+ * owned data or describe a run of fill bytes. The data is referenced, not
+ * copied, so buffers (headers in particular) may still be modified until
+ * the image is written.
+ */
+struct fwimage_seg {
+	const uint8_t	*data;		/* NULL for fill segments */
+	size_t		len;
+	uint8_t		fill;
+};
+
+struct fwimage {
+	struct fwimage_seg	*seg;
+	int			nseg;
+	int			maxseg;
+	size_t			size;
+};
+
+void fwimage_init(struct fwimage *img);
+void fwimage_free(struct fwimage *img);
+
+int fwimage_add(struct fwimage *img, const void *data, size_t len);
+int fwimage_fill(struct fwimage *img, uint8_t fill, size_t len);
+int fwimage_fill_to(struct fwimage *img, uint8_t fill, size_t offset);
+
+/*
+ * Call @fn for consecutive chunks of the image range [@offset,
+ * @offset + @len); fill segments are passed as chunks of a fill buffer.
+ */
+typedef void (*fwimage_walk_fn)(void *ctx, const uint8_t *data, size_t len);
+
+int fwimage_walk(const struct fwimage *img, size_t offset, size_t len,
+		 fwimage_walk_fn fn, void *ctx);
+
+int fwimage_write(const struct fwimage *img, const char *name);
+
+/*
+ * Streaming digests over an image range, available when the header of
+ * the respective implementation has been included before this one.
+ */
+#ifdef __MD5_INCLUDE__
+static inline void fwimage_md5_cb(void *ctx, const uint8_t *data, size_t len)
+{
+	MD5_Update((MD5_CTX *) ctx, data, (unsigned int) len);
+}
+
+static inline int fwimage_md5_update(MD5_CTX *ctx, const struct fwimage *img,
+				     size_t offset, size_t len)
+{
+	return fwimage_walk(img, offset, len, fwimage_md5_cb, ctx);
+}
+#endif
+
+#ifdef _SHA1_H
+static inline void fwimage_sha1_cb(void *ctx, const uint8_t *data, size_t len)
+{
+	sha1_update((sha1_context *) ctx, (uchar *) data, (uint) len);
+}
+
+static inline int fwimage_sha1_update(sha1_context *ctx,
+				      const struct fwimage *img,
+				      size_t offset, size_t len)
+{
+	return fwimage_walk(img, offset, len, fwimage_sha1_cb, ctx);
+}
+#endif
+
+#ifdef _SERVICES_CRC_CRC_H_
+static inline void fwimage_crc32_cb(void *ctx, const uint8_t *data, size_t len)
+{
+	cyg_uint32 *crc = ctx;
+
+	*crc = cyg_crc32_accumulate(*crc, (unsigned char *) data, len);
+}
+
+static inline int fwimage_crc32_update(cyg_uint32 *crc,
+				       const struct fwimage *img,
+				       size_t offset, size_t len)
+{
+	return fwimage_walk(img, offset, len, fwimage_crc32_cb, crc);
+}
+#endif
+
+#endif /* _FWIMAGE_H */
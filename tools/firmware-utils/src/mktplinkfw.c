@@ -20,12 +20,15 @@
 #include <getopt.h>     /* for getopt() */
 #include <stdarg.h>
 #include <errno.h>
+#include <ctype.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
 #include "md5.h"
+#include "fwimage.h"
 
 #define ALIGN(x,a) ({ typeof(a) __a = (a); (((x) + __a - 1) & ~(__a - 1)); })
 
@@ -156,6 +159,13 @@ static uint32_t reserved_space;
 static struct file_info inspect_info;
 static int extract = 0;
 
+static char *manifest;
+static long jobs;
+
+/* input files mapped once by the batch mode and shared by all images */
+static struct fwimage_file *file_cache;
+static int file_cache_len;
+
 char md5salt_normal[MD5SUM_LEN] = {
 	0xdc, 0xd7, 0x3a, 0xa5, 0xc3, 0x95, 0x98, 0xfb,
 	0xdd, 0xf9, 0xe7, 0xf4, 0x0e, 0xae, 0x47, 0x38,
@@ -427,7 +437,7 @@ static struct board_info boards[] = {
 #define ERRS(fmt, ...) do { \
 	int save = errno; \
 	fflush(0); \
-	fprintf(stderr, "[%s] *** error: " fmt "\n", \
+	fprintf(stderr, "[%s] *** error: " fmt ": %s\n", \
 			progname, ## __VA_ARGS__, strerror(save)); \
 } while (0)
 
@@ -508,21 +518,15 @@ static void usage(int status)
 "  -i <file>       inspect given firmware file <file>\n"
 "  -x              extract kernel and rootfs while inspecting (requires -i)\n"
 "  -X <size>       reserve <size> bytes in the firmware image (hexval prefixed with 0x)\n"
+"  -M <file>       build the images listed in <file>, one set of options per line;\n"
+"                  options given on the command line apply to every image\n"
+"  -P <jobs>       build up to <jobs> images of -M in parallel (default: number of CPUs)\n"
 "  -h              show this screen\n"
 	);
 
 	exit(status);
 }
 
-static int get_md5(char *data, int size, char *md5)
-{
-	MD5_CTX ctx;
-
-	MD5_Init(&ctx);
-	MD5_Update(&ctx, data, size);
-	MD5_Final(md5, &ctx);
-}
-
 static int get_file_stat(struct file_info *fdata)
 {
 	struct stat st;
@@ -541,32 +545,6 @@ static int get_file_stat(struct file_info *fdata)
 	return 0;
 }
 
-static int read_to_buf(struct file_info *fdata, char *buf)
-{
-	FILE *f;
-	int ret = EXIT_FAILURE;
-
-	f = fopen(fdata->file_name, "r");
-	if (f == NULL) {
-		ERRS("could not open \"%s\" for reading", fdata->file_name);
-		goto out;
-	}
-
-	errno = 0;
-	fread(buf, fdata->file_size, 1, f);
-	if (errno != 0) {
-		ERRS("unable to read from file \"%s\"", fdata->file_name);
-		goto out_close;
-	}
-
-	ret = EXIT_SUCCESS;
-
- out_close:
-	fclose(f);
- out:
-	return ret;
-}
-
 static int check_options(void)
 {
 	int ret;
@@ -699,9 +677,9 @@ static int check_options(void)
 	return 0;
 }
 
-static void fill_header(char *buf, int len)
+static int fill_header(struct fw_header *hdr, struct fwimage *img)
 {
-	struct fw_header *hdr = (struct fw_header *)buf;
+	MD5_CTX ctx;
 
 	memset(hdr, 0, sizeof(struct fw_header));
 
@@ -730,15 +708,21 @@ static void fill_header(char *buf, int len)
 	hdr->ver_mid = htons(fw_ver_mid);
 	hdr->ver_lo = htons(fw_ver_lo);
 
-	get_md5(buf, len, hdr->md5sum1);
+	/* the header is part of the image, with the salt in place of md5sum1 */
+	MD5_Init(&ctx);
+	if (fwimage_md5_update(&ctx, img, 0, img->size))
+		return -1;
+	MD5_Final(hdr->md5sum1, &ctx);
+
+	return 0;
 }
 
-static int pad_jffs2(char *buf, int currlen)
+static int pad_jffs2(struct fwimage *img)
 {
-	int len;
+	size_t len;
 	uint32_t pad_mask;
 
-	len = currlen;
+	len = img->size;
 	pad_mask = (64 * 1024);
 	while ((len < layout->fw_max_len) && (pad_mask != 0)) {
 		uint32_t mask;
@@ -751,6 +735,8 @@ static int pad_jffs2(char *buf, int currlen)
 		}
 
 		len = ALIGN(len, mask);
+		if (len >= layout->fw_max_len)
+			break;
 
 		for (i = 10; i < 32; i++) {
 			mask = 1 << i;
@@ -758,102 +744,112 @@ static int pad_jffs2(char *buf, int currlen)
 				pad_mask &= ~mask;
 		}
 
-		for (i = 0; i < sizeof(jffs2_eof_mark); i++)
-			buf[len + i] = jffs2_eof_mark[i];
+		if (fwimage_fill_to(img, 0xff, len) ||
+		    fwimage_add(img, jffs2_eof_mark, sizeof(jffs2_eof_mark)))
+			return -1;
 
 		len += sizeof(jffs2_eof_mark);
 	}
 
-	return len;
+	return 0;
 }
 
-static int write_fw(char *data, int len)
+static struct fwimage_file *find_cached_file(const char *name)
 {
-	FILE *f;
-	int ret = EXIT_FAILURE;
+	int i;
 
-	f = fopen(ofname, "w");
-	if (f == NULL) {
-		ERRS("could not open \"%s\" for writing", ofname);
-		goto out;
-	}
+	for (i = 0; i < file_cache_len; i++)
+		if (!strcmp(file_cache[i].name, name))
+			return &file_cache[i];
 
-	errno = 0;
-	fwrite(data, len, 1, f);
-	if (errno) {
-		ERRS("unable to write output file");
-		goto out_flush;
-	}
+	return NULL;
+}
 
-	DBG("firmware file \"%s\" completed", ofname);
+static int map_file(struct fwimage_file *f, struct file_info *fdata)
+{
+	struct fwimage_file *cached = find_cached_file(fdata->file_name);
 
-	ret = EXIT_SUCCESS;
+	if (cached) {
+		*f = *cached;
+	} else if (fwimage_map(f, fdata->file_name)) {
+		ERRS("could not open \"%s\" for reading", fdata->file_name);
+		return -1;
+	}
 
- out_flush:
-	fflush(f);
-	fclose(f);
-	if (ret != EXIT_SUCCESS) {
-		unlink(ofname);
+	/* the layout has been checked against the size seen by stat() */
+	if (f->size != fdata->file_size) {
+		ERR("file \"%s\" changed its size", fdata->file_name);
+		if (!cached)
+			fwimage_unmap(f);
+		return -1;
 	}
- out:
-	return ret;
+
+	return 0;
+}
+
+static void unmap_file(struct fwimage_file *f)
+{
+	if (!find_cached_file(f->name))
+		fwimage_unmap(f);
 }
 
 static int build_fw(void)
 {
-	int buflen;
-	char *buf;
-	char *p;
+	struct fw_header hdr;
+	struct fwimage_file kernel, rootfs;
+	struct fwimage img;
 	int ret = EXIT_FAILURE;
-	int writelen = 0;
 
-	buflen = layout->fw_max_len;
+	fwimage_init(&img);
+	memset(&rootfs, 0, sizeof(rootfs));
 
-	buf = malloc(buflen);
-	if (!buf) {
-		ERR("no memory for buffer\n");
+	if (map_file(&kernel, &kernel_info))
 		goto out;
-	}
 
-	memset(buf, 0xff, buflen);
-	p = buf + sizeof(struct fw_header);
-	ret = read_to_buf(&kernel_info, p);
-	if (ret)
-		goto out_free_buf;
+	if (!combined && map_file(&rootfs, &rootfs_info))
+		goto out_unmap;
 
-	writelen = sizeof(struct fw_header) + kernel_len;
+	if (fwimage_add(&img, &hdr, sizeof(hdr)) ||
+	    fwimage_add(&img, kernel.data, kernel.size) ||
+	    fwimage_fill_to(&img, 0xff, sizeof(hdr) + kernel_len))
+		goto err;
 
 	if (!combined) {
-		if (rootfs_align)
-			p = buf + writelen;
-		else
-			p = buf + rootfs_ofs;
+		if (!rootfs_align && fwimage_fill_to(&img, 0xff, rootfs_ofs))
+			goto err;
 
-		ret = read_to_buf(&rootfs_info, p);
-		if (ret)
-			goto out_free_buf;
+		if (fwimage_add(&img, rootfs.data, rootfs.size))
+			goto err;
 
-		if (rootfs_align)
-			writelen += rootfs_info.file_size;
-		else
-			writelen = rootfs_ofs + rootfs_info.file_size;
-
-		if (add_jffs2_eof)
-			writelen = pad_jffs2(buf, writelen);
+		if (add_jffs2_eof && pad_jffs2(&img))
+			goto err;
 	}
 
-	if (!strip_padding)
-		writelen = buflen;
+	if (!strip_padding &&
+	    fwimage_fill_to(&img, 0xff, layout->fw_max_len))
+		goto err;
 
-	fill_header(buf, writelen);
-	ret = write_fw(buf, writelen);
-	if (ret)
-		goto out_free_buf;
+	if (fill_header(&hdr, &img))
+		goto err;
 
-	ret = EXIT_SUCCESS;
+	if (fwimage_write(&img, ofname)) {
+		ERRS("unable to write output file \"%s\"", ofname);
+		goto out_free;
+	}
 
- out_free_buf:
-	free(buf);
+	DBG("firmware file \"%s\" completed", ofname);
+
+	ret = EXIT_SUCCESS;
+	goto out_free;
+
+ err:
+	ERRS("unable to build firmware image");
+ out_free:
+	fwimage_free(&img);
+	if (rootfs.data)
+		unmap_file(&rootfs);
+ out_unmap:
+	unmap_file(&kernel);
  out:
 	return ret;
 }
@@ -925,23 +921,31 @@ static inline void inspect_fw_pmd5sum(char *label, uint8_t *val, char *text)
 
 static int inspect_fw(void)
 {
+	struct fwimage_file f;
 	char *buf;
 	struct fw_header *hdr;
 	uint8_t md5sum[MD5SUM_LEN];
+	MD5_CTX ctx;
 	struct board_info *board;
 	int ret = EXIT_FAILURE;
 
-	buf = malloc(inspect_info.file_size);
-	if (!buf) {
-		ERR("no memory for buffer!\n");
+	/* mapped privately, restoring the salt below stays in memory */
+	if (fwimage_map(&f, inspect_info.file_name)) {
+		ERRS("could not open \"%s\" for reading",
+		     inspect_info.file_name);
 		goto out;
 	}
 
-	ret = read_to_buf(&inspect_info, buf);
-	if (ret)
-		goto out_free_buf;
+	buf = (char *) f.data;
 	hdr = (struct fw_header *)buf;
 
+	if (f.size < sizeof(struct fw_header)) {
+		ERR("file is too short for a V1 header!\n");
+		goto out_free_buf;
+	}
+
+	ret = EXIT_SUCCESS;
+
 	inspect_fw_pstr("File name", inspect_info.file_name);
 	inspect_fw_phexdec("File size", inspect_info.file_size);
 
@@ -960,7 +964,9 @@ static int inspect_fw(void)
 		memcpy(hdr->md5sum1, md5salt_normal, sizeof(md5sum));
 	else
 		memcpy(hdr->md5sum1, md5salt_boot, sizeof(md5sum));
-	get_md5(buf, inspect_info.file_size, hdr->md5sum1);
+	MD5_Init(&ctx);
+	MD5_Update(&ctx, buf, f.size);
+	MD5_Final(hdr->md5sum1, &ctx);
 
 	if (memcmp(md5sum, hdr->md5sum1, sizeof(md5sum))) {
 		inspect_fw_pmd5sum("Header MD5Sum1", md5sum, "(*ERROR*)");
@@ -1064,24 +1070,17 @@ static int inspect_fw(void)
 	}
 
  out_free_buf:
-	free(buf);
+	fwimage_unmap(&f);
  out:
 	return ret;
 }
 
-int main(int argc, char *argv[])
+static void parse_options(int argc, char *argv[])
 {
-	int ret = EXIT_FAILURE;
-	int err;
-
-	FILE *outfile;
-
-	progname = basename(argv[0]);
-
 	while ( 1 ) {
 		int c;
 
-		c = getopt(argc, argv, "a:B:H:E:F:L:V:N:W:ci:k:r:R:o:xX:hsjv:");
+		c = getopt(argc, argv, "a:B:H:E:F:L:V:N:W:ci:k:r:R:o:xX:hsjv:M:P:");
 		if (c == -1)
 			break;
 
@@ -1149,22 +1148,305 @@ int main(int argc, char *argv[])
 		case 'X':
 			sscanf(optarg, "0x%x", &reserved_space);
 			break;
+		case 'M':
+			manifest = optarg;
+			break;
+		case 'P':
+			jobs = strtol(optarg, NULL, 0);
+			break;
 		default:
 			usage(EXIT_FAILURE);
 			break;
 		}
 	}
+}
+
+static int run(void)
+{
+	int ret;
 
 	ret = check_options();
 	if (ret)
-		goto out;
+		return ret;
 
 	if (!inspect_info.file_name)
-		ret = build_fw();
-	else
-		ret = inspect_fw();
+		return build_fw();
+
+	return inspect_fw();
+}
+
+/*
+ * Batch mode
+ *
+ * Every line of the manifest holds the options for one image, on top of
+ * the options given on the command line. Empty lines and lines starting
+ * with '#' are ignored, arguments containing spaces can be double-quoted.
+ * The kernel and rootfs files are mapped once before forking the image
+ * builders, which then share them.
+ */
+struct batch_line {
+	int	lineno;
+	int	argc;
+	char	**argv;
+};
+
+static int split_line(struct batch_line *bl, char *s)
+{
+	int size = 0;
+
+	bl->argc = 0;
+	bl->argv = NULL;
+
+	while (1) {
+		char *arg;
+
+		while (isspace(*s))
+			s++;
+
+		if (!*s || (*s == '#' && !bl->argc))
+			break;
+
+		if (*s == '"') {
+			arg = ++s;
+			while (*s && *s != '"')
+				s++;
+			if (!*s) {
+				ERR("line %d: unterminated quote", bl->lineno);
+				return -1;
+			}
+		} else {
+			arg = s;
+			while (*s && !isspace(*s))
+				s++;
+		}
+
+		if (*s)
+			*s++ = '\0';
+
+		/* argv[0] and the terminating NULL */
+		if (bl->argc + 2 >= size) {
+			size = size ? size * 2 : 16;
+			bl->argv = realloc(bl->argv, size * sizeof(char *));
+			if (!bl->argv) {
+				ERR("no memory for manifest");
+				return -1;
+			}
+			if (!bl->argc)
+				bl->argv[bl->argc++] = progname;
+		}
+
+		bl->argv[bl->argc++] = arg;
+	}
+
+	if (bl->argv)
+		bl->argv[bl->argc] = NULL;
+
+	return 0;
+}
+
+static int read_manifest(struct batch_line **lines)
+{
+	struct batch_line *bl = NULL;
+	char buf[1024];
+	int n = 0, size = 0, lineno = 0;
+	FILE *f;
+
+	f = fopen(manifest, "r");
+	if (f == NULL) {
+		ERRS("could not open \"%s\" for reading", manifest);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		char *s;
+
+		lineno++;
+
+		if (n == size) {
+			size = size ? size * 2 : 64;
+			bl = realloc(bl, size * sizeof(*bl));
+			if (!bl) {
+				ERR("no memory for manifest");
+				goto err;
+			}
+		}
+
+		/* the arguments must outlive the line buffer */
+		s = strdup(buf);
+		if (!s) {
+			ERR("no memory for manifest");
+			goto err;
+		}
+
+		bl[n].lineno = lineno;
+		if (split_line(&bl[n], s))
+			goto err;
+
+		if (bl[n].argc)
+			n++;
+		else
+			free(s);
+	}
+
+	fclose(f);
+	*lines = bl;
+	return n;
+
+ err:
+	fclose(f);
+	return -1;
+}
+
+static int cache_file(const char *name)
+{
+	struct fwimage_file *f;
+
+	if (find_cached_file(name))
+		return 0;
+
+	f = realloc(file_cache, (file_cache_len + 1) * sizeof(*f));
+	if (!f) {
+		ERR("no memory for file cache");
+		return -1;
+	}
+	file_cache = f;
+
+	if (fwimage_map(&file_cache[file_cache_len], name)) {
+		ERRS("could not open \"%s\" for reading", name);
+		return -1;
+	}
+	file_cache_len++;
+
+	return 0;
+}
+
+static int cache_files(struct batch_line *lines, int n)
+{
+	int i, j;
+
+	if (kernel_info.file_name && cache_file(kernel_info.file_name))
+		return -1;
+
+	if (rootfs_info.file_name && cache_file(rootfs_info.file_name))
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		for (j = 1; j < lines[i].argc - 1; j++) {
+			if (strcmp(lines[i].argv[j], "-k") &&
+			    strcmp(lines[i].argv[j], "-r"))
+				continue;
+
+			if (cache_file(lines[i].argv[++j]))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int wait_image(struct batch_line *lines, pid_t *pids, int n)
+{
+	int status, i;
+	pid_t pid;
+
+	do {
+		pid = wait(&status);
+	} while (pid < 0 && errno == EINTR);
+
+	if (pid < 0) {
+		ERRS("wait failed");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++)
+		if (pids[i] == pid)
+			break;
+
+	if (i == n)
+		return 0;
+
+	pids[i] = 0;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		ERR("%s line %d failed", manifest, lines[i].lineno);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int run_batch(void)
+{
+	struct batch_line *lines;
+	pid_t *pids;
+	int ret = EXIT_SUCCESS;
+	int n, i, running = 0;
+
+	n = read_manifest(&lines);
+	if (n < 0)
+		return EXIT_FAILURE;
+
+	if (cache_files(lines, n))
+		return EXIT_FAILURE;
+
+	pids = calloc(n ? n : 1, sizeof(*pids));
+	if (!pids) {
+		ERR("no memory for job list");
+		return EXIT_FAILURE;
+	}
+
+	if (jobs <= 0)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs <= 0)
+		jobs = 1;
+
+	/* flush before forking, children would print it again */
+	fflush(0);
+
+	for (i = 0; i < n; i++) {
+		if (running == jobs) {
+			if (wait_image(lines, pids, n))
+				ret = EXIT_FAILURE;
+			running--;
+		}
+
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			ERRS("fork failed");
+			pids[i] = 0;
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		if (pids[i] == 0) {
+			/* the options of the line override the defaults */
+			optind = 1;
+			parse_options(lines[i].argc, lines[i].argv);
+
+			ret = run();
+			fflush(0);
+			_exit(ret);
+		}
+
+		running++;
+	}
+
+	while (running--)
+		if (wait_image(lines, pids, n))
+			ret = EXIT_FAILURE;
+
+	free(pids);
 
- out:
 	return ret;
 }
 
+int main(int argc, char *argv[])
+{
+	progname = basename(argv[0]);
+
+	parse_options(argc, argv);
+
+	if (manifest)
+		return run_batch();
+
+	return run();
+}
@@ -29,15 +29,40 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <errno.h>
+#include <byteswap.h>
+#include <sys/syscall.h>
+
+#include "cyg_crc.h"
+
+/* lseek() whence values for sparse files, hidden without _GNU_SOURCE */
+#if defined(__linux__) && !defined(SEEK_DATA)
+#define SEEK_DATA	3
+#define SEEK_HOLE	4
+#endif
 
 #if __BYTE_ORDER == __BIG_ENDIAN
 #define cpu_to_le16(x) bswap_16(x)
+#define cpu_to_le32(x) bswap_32(x)
+#define cpu_to_le64(x) bswap_64(x)
 #elif __BYTE_ORDER == __LITTLE_ENDIAN
 #define cpu_to_le16(x) (x)
+#define cpu_to_le32(x) (x)
+#define cpu_to_le64(x) (x)
 #else
 #error unknown endianness!
 #endif
 
+#define SECTOR_SIZE		512
+
+#define GPT_SIGNATURE		0x5452415020494645ULL	/* "EFI PART" */
+#define GPT_REVISION		0x00010000
+#define GPT_HEADER_SIZE		92
+#define GPT_ENTRY_MAX		128
+#define GPT_ENTRY_SIZE		128
+#define GPT_ENTRY_SECTORS	(GPT_ENTRY_MAX * GPT_ENTRY_SIZE / SECTOR_SIZE)
+#define GPT_FIRST_LBA		(2 + GPT_ENTRY_SECTORS)
+
 /* Partition table entry */
 struct pte { 
 	unsigned char active;
@@ -48,9 +73,78 @@ struct pte {
 	unsigned int length;
 };
 
+/* GUIDs are stored with the first three fields little endian */
+typedef struct {
+	uint8_t b[16];
+} guid_t;
+
+#define GUID_INIT(a, b, c, d0, d1, d2, d3, d4, d5, d6, d7)		\
+	{{ (a) & 0xff, ((a) >> 8) & 0xff, ((a) >> 16) & 0xff,		\
+	   ((a) >> 24) & 0xff, (b) & 0xff, ((b) >> 8) & 0xff,		\
+	   (c) & 0xff, ((c) >> 8) & 0xff,				\
+	   d0, d1, d2, d3, d4, d5, d6, d7 }}
+
+#define GUID_LINUX_FS	GUID_INIT(0x0fc63daf, 0x8483, 0x4772, \
+				  0x8e, 0x79, 0x3d, 0x69, 0xd8, 0x47, 0x7d, 0xe4)
+#define GUID_SWAP	GUID_INIT(0x0657fd6d, 0xa4ab, 0x43c4, \
+				  0x84, 0xe5, 0x09, 0x33, 0xc8, 0x4b, 0x4f, 0x4f)
+#define GUID_ESP	GUID_INIT(0xc12a7328, 0xf81f, 0x11d2, \
+				  0xba, 0x4b, 0x00, 0xa0, 0xc9, 0x3e, 0xc9, 0x3b)
+#define GUID_BASIC_DATA	GUID_INIT(0xebd0a0a2, 0xb9e5, 0x4433, \
+				  0x87, 0xc0, 0x68, 0xb6, 0xb7, 0x26, 0x99, 0xc7)
+#define GUID_BIOS_BOOT	GUID_INIT(0x21686148, 0x6449, 0x6e6f, \
+				  0x74, 0x4e, 0x65, 0x65, 0x64, 0x45, 0x46, 0x49)
+
+/* MBR partition types and the GPT partition types they are mapped to */
+static const struct {
+	unsigned char type;
+	guid_t guid;
+} gpt_types[] = {
+	{ 0x83, GUID_LINUX_FS },
+	{ 0x82, GUID_SWAP },
+	{ 0xef, GUID_ESP },
+	{ 0x01, GUID_BASIC_DATA },
+	{ 0x04, GUID_BASIC_DATA },
+	{ 0x06, GUID_BASIC_DATA },
+	{ 0x0b, GUID_BASIC_DATA },
+	{ 0x0c, GUID_BASIC_DATA },
+	{ 0x0e, GUID_BASIC_DATA },
+	{ 0xda, GUID_BIOS_BOOT },
+};
+
+struct gpt_header {
+	uint64_t signature;
+	uint32_t revision;
+	uint32_t size;
+	uint32_t crc32;
+	uint32_t reserved;
+	uint64_t self;
+	uint64_t alternate;
+	uint64_t first_usable;
+	uint64_t last_usable;
+	guid_t disk_guid;
+	uint64_t first_entry;
+	uint32_t entry_num;
+	uint32_t entry_size;
+	uint32_t entry_crc32;
+	uint8_t pad[SECTOR_SIZE - GPT_HEADER_SIZE];
+} __attribute__((packed));
+
+struct gpt_entry {
+	guid_t type;
+	guid_t guid;
+	uint64_t start;
+	uint64_t end;
+	uint64_t attr;
+	uint16_t name[36];
+} __attribute__((packed));
+
 struct partinfo {
 	unsigned long size;
 	int type;
+	char *file;
+	uint64_t start;		/* in sectors */
+	uint64_t len;
 };
 
 int verbose = 0;
@@ -58,7 +152,9 @@ int active = 1;
 int heads = -1;
 int sectors = -1;
 int kb_align = 0;
-struct partinfo parts[4];
+int use_gpt = 0;
+int no_pad = 0;
+struct partinfo parts[GPT_ENTRY_MAX];
 char *filename = NULL;
 
 
@@ -96,7 +192,7 @@ static long to_kbytes(const char *string) {
 }
 
 /* convert the sector number into a CHS value for the partition table */
-static void to_chs(long sect, unsigned char chs[3]) {
+static void to_chs(uint64_t sect, unsigned char chs[3]) {
 	int c,h,s;
 	
 	s = (sect % sectors) + 1;
@@ -113,23 +209,263 @@ static void to_chs(long sect, unsigned char chs[3]) {
 }
 
 /* round the sector number up to the next cylinder */
-static inline unsigned long round_to_cyl(long sect) {
+static inline uint64_t round_to_cyl(uint64_t sect) {
 	int cyl_size = heads * sectors;
 
 	return sect + cyl_size - (sect % cyl_size); 
 }
 
 /* round the sector number up to the kb_align boundary */
-static inline unsigned long round_to_kb(long sect) {
+static inline uint64_t round_to_kb(uint64_t sect) {
         return ((sect - 1) / kb_align + 1) * kb_align;
 }
 
+/*
+ * The disk and partition GUIDs are derived from the disk signature, which
+ * keeps images reproducible
+ */
+static void make_guid(guid_t *guid, uint32_t signature, int index)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		guid->b[i] = signature >> (8 * (i % 4));
+
+	guid->b[15] ^= index;
+
+	/* random (version 4) GUID, RFC 4122 variant */
+	guid->b[7] = (guid->b[7] & 0x0f) | 0x40;
+	guid->b[8] = (guid->b[8] & 0x3f) | 0x80;
+}
+
+static void gpt_type(guid_t *guid, int type)
+{
+	int i;
+
+	for (i = 0; i < sizeof(gpt_types) / sizeof(gpt_types[0]); i++) {
+		if (gpt_types[i].type == (unsigned char) type) {
+			*guid = gpt_types[i].guid;
+			return;
+		}
+	}
+
+	*guid = gpt_types[0].guid;
+}
+
+static int pwrite_all(int fd, const void *buf, size_t len, off_t offset)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = pwrite(fd, p, len, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			fprintf(stderr, "write failed.\n");
+			return -1;
+		}
+		p += n;
+		offset += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int write_gpt(int fd, uint32_t signature, int nr, uint64_t disk_sectors)
+{
+	struct gpt_entry *gpte;
+	struct gpt_header hdr;
+	size_t gpte_size = GPT_ENTRY_MAX * sizeof(*gpte);
+	uint64_t backup = disk_sectors - 1;
+	int i, ret = -1;
+
+	gpte = calloc(GPT_ENTRY_MAX, sizeof(*gpte));
+	if (!gpte) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	for (i = 0; i < nr; i++) {
+		gpt_type(&gpte[i].type, parts[i].type);
+		make_guid(&gpte[i].guid, signature, i + 1);
+		gpte[i].start = cpu_to_le64(parts[i].start);
+		gpte[i].end = cpu_to_le64(parts[i].start + parts[i].len - 1);
+		/* legacy BIOS bootable */
+		if ((i + 1) == active)
+			gpte[i].attr = cpu_to_le64(1ULL << 2);
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.signature = cpu_to_le64(GPT_SIGNATURE);
+	hdr.revision = cpu_to_le32(GPT_REVISION);
+	hdr.size = cpu_to_le32(GPT_HEADER_SIZE);
+	hdr.self = cpu_to_le64(1);
+	hdr.alternate = cpu_to_le64(backup);
+	hdr.first_usable = cpu_to_le64(GPT_FIRST_LBA);
+	hdr.last_usable = cpu_to_le64(backup - GPT_ENTRY_SECTORS - 1);
+	make_guid(&hdr.disk_guid, signature, 0);
+	hdr.first_entry = cpu_to_le64(2);
+	hdr.entry_num = cpu_to_le32(GPT_ENTRY_MAX);
+	hdr.entry_size = cpu_to_le32(GPT_ENTRY_SIZE);
+	hdr.entry_crc32 = cpu_to_le32(cyg_ether_crc32((unsigned char *) gpte,
+						      gpte_size));
+	hdr.crc32 = cpu_to_le32(cyg_ether_crc32((unsigned char *) &hdr,
+						GPT_HEADER_SIZE));
+
+	if (pwrite_all(fd, &hdr, sizeof(hdr), SECTOR_SIZE) ||
+	    pwrite_all(fd, gpte, gpte_size, 2 * SECTOR_SIZE))
+		goto out;
+
+	/* the backup header at the end of the disk follows its entries */
+	hdr.crc32 = 0;
+	hdr.self = cpu_to_le64(backup);
+	hdr.alternate = cpu_to_le64(1);
+	hdr.first_entry = cpu_to_le64(backup - GPT_ENTRY_SECTORS);
+	hdr.crc32 = cpu_to_le32(cyg_ether_crc32((unsigned char *) &hdr,
+						GPT_HEADER_SIZE));
+
+	if (pwrite_all(fd, gpte, gpte_size,
+		       (off_t) (backup - GPT_ENTRY_SECTORS) * SECTOR_SIZE) ||
+	    pwrite_all(fd, &hdr, sizeof(hdr), (off_t) backup * SECTOR_SIZE))
+		goto out;
+
+	ret = 0;
+out:
+	free(gpte);
+	return ret;
+}
+
+static int copy_range(int in, int out, off_t from, off_t to, uint64_t len)
+{
+	static char buf[1024 * 1024];
+	ssize_t n;
+
+#ifdef __NR_copy_file_range
+	/* in-kernel copy, which shares the extents where supported */
+	while (len) {
+		loff_t in_off = from, out_off = to;
+
+		n = syscall(__NR_copy_file_range, in, &in_off, out, &out_off,
+			    len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		from += n;
+		to += n;
+		len -= n;
+	}
+#endif
+
+	while (len) {
+		size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+
+		n = pread(in, buf, chunk, from);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			fprintf(stderr, "read failed.\n");
+			return -1;
+		}
+
+		if (pwrite_all(out, buf, n, to))
+			return -1;
+
+		from += n;
+		to += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * copy a partition image to its place in the output file, skipping the
+ * holes of sparse input files; the output is sparse already
+ */
+static int copy_file(int out, int i)
+{
+	struct stat st;
+	off_t data, hole, base = (off_t) parts[i].start * SECTOR_SIZE;
+	int in, ret = -1;
+
+	if ((in = open(parts[i].file, O_RDONLY)) < 0) {
+		fprintf(stderr, "Can't open input file '%s'\n", parts[i].file);
+		return -1;
+	}
+
+	if (fstat(in, &st)) {
+		fprintf(stderr, "Can't stat input file '%s'\n", parts[i].file);
+		goto out;
+	}
+
+	if ((uint64_t) st.st_size > parts[i].len * SECTOR_SIZE) {
+		fprintf(stderr, "File '%s' does not fit into partition %d\n",
+			parts[i].file, i);
+		goto out;
+	}
+
+	/* without padding, the image ends with the last file */
+	if (no_pad) {
+		struct stat ost;
+
+		if (fstat(out, &ost) || (ost.st_size < base + st.st_size &&
+		    ftruncate(out, base + st.st_size))) {
+			fprintf(stderr, "Can't resize output file '%s'\n", filename);
+			goto out;
+		}
+	}
+
+	for (data = 0; data < st.st_size; data = hole) {
+#ifdef SEEK_DATA
+		data = lseek(in, data, SEEK_DATA);
+		if (data < 0) {
+			if (errno == ENXIO)
+				break;
+			/* no hole support, copy everything */
+			data = 0;
+			hole = st.st_size;
+		} else {
+			hole = lseek(in, data, SEEK_HOLE);
+			if (hole < 0 || hole > st.st_size)
+				hole = st.st_size;
+		}
+#else
+		hole = st.st_size;
+#endif
+
+		if (copy_range(in, out, data, base + data, hole - data))
+			goto out;
+	}
+
+	if (verbose)
+		fprintf(stderr, "Partition %d: copied '%s'\n", i, parts[i].file);
+
+	ret = 0;
+out:
+	close(in);
+	return ret;
+}
+
 /* check the partition sizes and write the partition table */
 static int gen_ptable(uint32_t signature, int nr)
 {
 	struct pte pte[4];
-	unsigned long sect = 0; 
-	int i, fd, ret = -1, start, len;
+	uint64_t sect = 0, start, len, disk_sectors;
+	int i, fd, ret = -1, files = 0;
+
+	if (use_gpt && no_pad) {
+		fprintf(stderr, "GPT images need the backup table at the end of the disk\n");
+		return -1;
+	}
+
+	if (!use_gpt && nr > 4) {
+		fprintf(stderr, "Too many partitions for MBR, use GPT (-g)\n");
+		return -1;
+	}
 
 	memset(pte, 0, sizeof(struct pte) * 4);
 	for (i = 0; i < nr; i++) {
@@ -137,22 +473,51 @@ static int gen_ptable(uint32_t signature, int nr)
 			fprintf(stderr, "Invalid size in partition %d!\n", i);
 			return -1;
 		}
-		pte[i].active = ((i + 1) == active) ? 0x80 : 0;
-		pte[i].type = parts[i].type;
 		start = sect + sectors;
+		if (use_gpt && start < GPT_FIRST_LBA)
+			start = GPT_FIRST_LBA;
 		if (kb_align != 0)
 			start = round_to_kb(start);
-		pte[i].start = cpu_to_le16(start);
-		sect = start + parts[i].size * 2;
+		sect = start + (uint64_t) parts[i].size * 2;
 		if (kb_align == 0)
 			sect = round_to_cyl(sect);
-		pte[i].length = cpu_to_le16(len = sect - start);
-		to_chs(start, pte[i].chs_start);
-		to_chs(start + len - 1, pte[i].chs_end);
+		len = sect - start;
+
+		parts[i].start = start;
+		parts[i].len = len;
+		if (parts[i].file)
+			files++;
+
+		if (!use_gpt) {
+			if (start + len > 0xffffffffULL) {
+				fprintf(stderr, "Partition %d exceeds the MBR limits, use GPT (-g)\n", i);
+				return -1;
+			}
+			pte[i].active = ((i + 1) == active) ? 0x80 : 0;
+			pte[i].type = parts[i].type;
+			pte[i].start = cpu_to_le32(start);
+			pte[i].length = cpu_to_le32(len);
+			to_chs(start, pte[i].chs_start);
+			to_chs(start + len - 1, pte[i].chs_end);
+		}
 		if (verbose)
-			fprintf(stderr, "Partition %d: start=%ld, end=%ld, size=%ld\n", i, (long) start * 512, ((long) start + (long) len) * 512, (long) len * 512);
-		printf("%ld\n", ((long) start * 512));
-		printf("%ld\n", ((long) len * 512));
+			fprintf(stderr, "Partition %d: start=%llu, end=%llu, size=%llu\n", i, (unsigned long long) start * 512, ((unsigned long long) start + len) * 512, (unsigned long long) len * 512);
+		printf("%llu\n", ((unsigned long long) start * 512));
+		printf("%llu\n", ((unsigned long long) len * 512));
+	}
+
+	disk_sectors = sect;
+	if (use_gpt) {
+		/* room for the backup entries and header */
+		disk_sectors += GPT_ENTRY_SECTORS + 1;
+
+		/* protective MBR covering the whole disk */
+		pte[0].chs_start[1] = 2;
+		pte[0].type = 0xee;
+		memset(pte[0].chs_end, 0xff, sizeof(pte[0].chs_end));
+		pte[0].start = cpu_to_le32(1);
+		pte[0].length = cpu_to_le32(disk_sectors - 1 > 0xffffffffULL ?
+					    0xffffffff : disk_sectors - 1);
 	}
 
 	if ((fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
@@ -160,6 +525,12 @@ static int gen_ptable(uint32_t signature, int nr)
 		return -1;
 	}
 
+	/* a complete (sparse) disk image when partition contents are given */
+	if (files && !no_pad && ftruncate(fd, (off_t) disk_sectors * SECTOR_SIZE)) {
+		fprintf(stderr, "Can't resize output file '%s'\n", filename);
+		goto fail;
+	}
+
 	lseek(fd, 440, SEEK_SET);
 	if (write(fd, &signature, sizeof(signature)) != sizeof(signature)) {
 		fprintf(stderr, "write failed.\n");
@@ -176,16 +547,26 @@ static int gen_ptable(uint32_t signature, int nr)
 		fprintf(stderr, "write failed.\n");
 		goto fail;
 	}
-	
+
+	if (use_gpt && write_gpt(fd, signature, nr, disk_sectors))
+		goto fail;
+
+	for (i = 0; i < nr; i++) {
+		if (parts[i].file && copy_file(fd, i))
+			goto fail;
+	}
+
 	ret = 0;
 fail:
 	close(fd);
+	if (ret && files)
+		unlink(filename);
 	return ret;
 }
 
 static void usage(char *prog)
 {
-	fprintf(stderr,	"Usage: %s [-v] -h <heads> -s <sectors> -o <outputfile> [-a 0..4] [-l <align kB>] [[-t <type>] -p <size>...] \n", prog);
+	fprintf(stderr,	"Usage: %s [-v] [-g] [-n] -h <heads> -s <sectors> -o <outputfile> [-a 0..4] [-l <align kB>] [[-t <type>] [-f <file>] -p <size>...] \n", prog);
 	exit(1);
 }
 
@@ -194,9 +575,10 @@ int main (int argc, char **argv)
 	char type = 0x83;
 	int ch;
 	int part = 0;
+	char *file = NULL;
 	uint32_t signature = 0x5452574F; /* 'OWRT' */
 
-	while ((ch = getopt(argc, argv, "h:s:p:a:t:o:vl:S:")) != -1) {
+	while ((ch = getopt(argc, argv, "h:s:p:a:t:o:vl:S:gf:n")) != -1) {
 		switch (ch) {
 		case 'o':
 			filename = optarg;
@@ -211,19 +593,30 @@ int main (int argc, char **argv)
 			sectors = (int) strtoul(optarg, NULL, 0);
 			break;
 		case 'p':
-			if (part > 3) {
+			if (part >= GPT_ENTRY_MAX) {
 				fprintf(stderr, "Too many partitions\n");
 				exit(1);
 			}
 			parts[part].size = to_kbytes(optarg);
+			parts[part].file = file;
 			parts[part++].type = type;
+			file = NULL;
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'g':
+			use_gpt = 1;
+			break;
+		case 'n':
+			no_pad = 1;
 			break;
 		case 't':
 			type = (char) strtoul(optarg, NULL, 16);
 			break;
 		case 'a':
 			active = (int) strtoul(optarg, NULL, 0);
-			if ((active < 0) || (active > 4))
+			if ((active < 0) || (active > GPT_ENTRY_MAX))
 				active = 0;
 			break;
 		case 'l':
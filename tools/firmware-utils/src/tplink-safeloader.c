@@ -48,16 +48,26 @@
 #include <sys/stat.h>
 
 #include "md5.h"
+#include "fwimage.h"
 
 
 #define ALIGN(x,a) ({ typeof(a) __a = (a); (((x) + __a - 1) & ~(__a - 1)); })
 
 
-/** An image partition table entry */
+/**
+   An image partition table entry
+
+   Partitions read from files reference the mapped file; data_size bytes of
+   data are followed by 0xff padding up to size, the last four bytes of which
+   are replaced by the JFFS2 EOF mark if jffs2_eof is set.
+*/
 struct image_partition_entry {
 	const char *name;
 	size_t size;
 	uint8_t *data;
+	size_t data_size;
+	bool jffs2_eof;
+	struct fwimage_file file;
 };
 
 /** A flash partition table entry */
@@ -153,7 +163,7 @@ static const unsigned char cpe510_support_list[] =
 
 /** Allocates a new image partition */
 struct image_partition_entry alloc_image_partition(const char *name, size_t len) {
-	struct image_partition_entry entry = {name, len, malloc(len)};
+	struct image_partition_entry entry = {name, len, malloc(len), len};
 	if (!entry.data)
 		error(1, errno, "malloc");
 
@@ -162,7 +172,10 @@ struct image_partition_entry alloc_image_partition(const char *name, size_t len)
 
 /** Frees an image partition */
 void free_image_partition(struct image_partition_entry entry) {
-	free(entry.data);
+	if (entry.file.name)
+		fwimage_unmap(&entry.file);
+	else
+		free(entry.data);
 }
 
 /** Generates the partition-table partition */
@@ -241,40 +254,42 @@ struct image_partition_entry make_support_list(const unsigned char *support_list
 
 /** Creates a new image partition with an arbitrary name from a file */
 struct image_partition_entry read_file(const char *part_name, const char *filename, bool add_jffs2_eof) {
-	struct stat statbuf;
-
-	if (stat(filename, &statbuf) < 0)
-		error(1, errno, "unable to stat file `%s'", filename);
+	struct image_partition_entry entry = {part_name};
 
-	size_t len = statbuf.st_size;
+	if (fwimage_map(&entry.file, filename))
+		error(1, errno, "unable to read file `%s'", filename);
 
-	if (add_jffs2_eof)
-		len = ALIGN(len, 0x10000) + sizeof(jffs2_eof_mark);
+	entry.data = entry.file.data;
+	entry.data_size = entry.size = entry.file.size;
 
-	struct image_partition_entry entry = alloc_image_partition(part_name, len);
+	if (add_jffs2_eof) {
+		entry.size = ALIGN(entry.size, 0x10000) + sizeof(jffs2_eof_mark);
+		entry.jffs2_eof = true;
+	}
 
-	FILE *file = fopen(filename, "rb");
-	if (!file)
-		error(1, errno, "unable to open file `%s'", filename);
+	return entry;
+}
 
-	if (fread(entry.data, statbuf.st_size, 1, file) != 1)
-		error(1, errno, "unable to read file `%s'", filename);
+/** Appends the content of an image partition to an image */
+static void add_partition(struct fwimage *img, const struct image_partition_entry *part) {
+	size_t end = img->size + part->size;
 
-	if (add_jffs2_eof) {
-		uint8_t *eof = entry.data + statbuf.st_size, *end = entry.data+entry.size;
+	if (fwimage_add(img, part->data, part->data_size))
+		error(1, errno, "fwimage_add");
 
-		memset(eof, 0xff, end - eof - sizeof(jffs2_eof_mark));
-		memcpy(end - sizeof(jffs2_eof_mark), jffs2_eof_mark, sizeof(jffs2_eof_mark));
+	if (part->jffs2_eof) {
+		if (fwimage_fill_to(img, 0xff, end - sizeof(jffs2_eof_mark)) ||
+		    fwimage_add(img, jffs2_eof_mark, sizeof(jffs2_eof_mark)))
+			error(1, errno, "fwimage_add");
 	}
 
-	fclose(file);
-
-	return entry;
+	if (fwimage_fill_to(img, 0xff, end))
+		error(1, errno, "fwimage_fill");
 }
 
 
 /**
-   Copies a list of image partitions into an image buffer and generates the image partition table while doing so
+   Appends a list of image partitions to an image and generates the image partition table while doing so
 
    Example image partition table:
 
@@ -300,13 +315,16 @@ struct image_partition_entry read_file(const char *part_name, const char *filena
 
    I think partition-table must be the first partition in the firmware image.
 */
-void put_partitions(uint8_t *buffer, const struct image_partition_entry *parts) {
+void put_partitions(struct fwimage *img, uint8_t *buffer, const struct image_partition_entry *parts) {
 	size_t i;
 	char *image_pt = (char *)buffer, *end = image_pt + 0x800;
 
+	if (fwimage_add(img, buffer, 0x800))
+		error(1, errno, "fwimage_add");
+
 	size_t base = 0x800;
 	for (i = 0; parts[i].name; i++) {
-		memcpy(buffer + base, parts[i].data, parts[i].size);
+		add_partition(img, &parts[i]);
 
 		size_t len = end-image_pt;
 		size_t w = snprintf(image_pt, len, "fwup-ptn %s base 0x%05x size 0x%05x\t\r\n", parts[i].name, (unsigned)base, (unsigned)parts[i].size);
@@ -325,12 +343,13 @@ void put_partitions(uint8_t *buffer, const struct image_partition_entry *parts)
 }
 
 /** Generates and writes the image MD5 checksum */
-void put_md5(uint8_t *md5, uint8_t *buffer, unsigned int len) {
+void put_md5(uint8_t *md5, const struct fwimage *img, size_t offset) {
 	MD5_CTX ctx;
 
 	MD5_Init(&ctx);
 	MD5_Update(&ctx, md5_salt, (unsigned int)sizeof(md5_salt));
-	MD5_Update(&ctx, buffer, len);
+	if (fwimage_md5_update(&ctx, img, offset, img->size - offset))
+		error(1, errno, "fwimage_md5_update");
 	MD5_Final(md5, &ctx);
 }
 
@@ -349,29 +368,25 @@ void put_md5(uint8_t *md5, uint8_t *buffer, unsigned int len) {
      1014-1813    Image partition table (2048 bytes, padded with 0xff)
      1814-xxxx    Firmware partitions
 */
-void * generate_factory_image(const unsigned char *vendor, size_t vendor_len, const struct image_partition_entry *parts, size_t *len) {
-	*len = 0x1814;
+void generate_factory_image(struct fwimage *img, uint8_t *header, uint8_t *ptable, const unsigned char *vendor, size_t vendor_len, const struct image_partition_entry *parts) {
+	size_t len = 0x1814;
 
 	size_t i;
 	for (i = 0; parts[i].name; i++)
-		*len += parts[i].size;
-
-	uint8_t *image = malloc(*len);
-	if (!image)
-		error(1, errno, "malloc");
-
-	image[0] = *len >> 24;
-	image[1] = *len >> 16;
-	image[2] = *len >> 8;
-	image[3] = *len;
+		len += parts[i].size;
 
-	memcpy(image+0x14, vendor, vendor_len);
-	memset(image+0x14+vendor_len, 0xff, 4096-vendor_len);
+	header[0] = len >> 24;
+	header[1] = len >> 16;
+	header[2] = len >> 8;
+	header[3] = len;
 
-	put_partitions(image + 0x1014, parts);
-	put_md5(image+0x04, image+0x14, *len-0x14);
+	if (fwimage_add(img, header, 0x14) ||
+	    fwimage_add(img, vendor, vendor_len) ||
+	    fwimage_fill_to(img, 0xff, 0x1014))
+		error(1, errno, "fwimage_add");
 
-	return image;
+	put_partitions(img, ptable, parts);
+	put_md5(header+0x04, img, 0x14);
 }
 
 /**
@@ -381,7 +396,7 @@ void * generate_factory_image(const unsigned char *vendor, size_t vendor_len, co
    should be generalized when TP-LINK starts building its safeloader into hardware with
    different flash layouts.
 */
-void * generate_sysupgrade_image(const struct flash_partition_entry *flash_parts, const struct image_partition_entry *image_parts, size_t *len) {
+void generate_sysupgrade_image(struct fwimage *img, const struct flash_partition_entry *flash_parts, const struct image_partition_entry *image_parts) {
 	const struct flash_partition_entry *flash_os_image = &flash_parts[5];
 	const struct flash_partition_entry *flash_soft_version = &flash_parts[6];
 	const struct flash_partition_entry *flash_support_list = &flash_parts[7];
@@ -407,20 +422,19 @@ void * generate_sysupgrade_image(const struct flash_partition_entry *flash_parts
 	if (image_file_system->size > flash_file_system->size)
 		error(1, 0, "rootfs image too big (more than %u bytes)", (unsigned)flash_file_system->size);
 
-	*len = flash_file_system->base - flash_os_image->base + image_file_system->size;
+	add_partition(img, image_os_image);
 
-	uint8_t *image = malloc(*len);
-	if (!image)
-		error(1, errno, "malloc");
-
-	memset(image, 0xff, *len);
+	if (fwimage_fill_to(img, 0xff, flash_soft_version->base - flash_os_image->base))
+		error(1, 0, "soft-version partition overlaps os-image");
+	add_partition(img, image_soft_version);
 
-	memcpy(image, image_os_image->data, image_os_image->size);
-	memcpy(image + flash_soft_version->base - flash_os_image->base, image_soft_version->data, image_soft_version->size);
-	memcpy(image + flash_support_list->base - flash_os_image->base, image_support_list->data, image_support_list->size);
-	memcpy(image + flash_file_system->base - flash_os_image->base, image_file_system->data, image_file_system->size);
+	if (fwimage_fill_to(img, 0xff, flash_support_list->base - flash_os_image->base))
+		error(1, 0, "support-list partition overlaps soft-version");
+	add_partition(img, image_support_list);
 
-	return image;
+	if (fwimage_fill_to(img, 0xff, flash_file_system->base - flash_os_image->base))
+		error(1, 0, "file-system partition overlaps support-list");
+	add_partition(img, image_file_system);
 }
 
 
@@ -434,23 +448,20 @@ static void do_cpe510(const char *output, const char *kernel_image, const char *
 	parts[3] = read_file("os-image", kernel_image, false);
 	parts[4] = read_file("file-system", rootfs_image, add_jffs2_eof);
 
-	size_t len;
-	void *image;
-	if (sysupgrade)
-		image = generate_sysupgrade_image(cpe510_partitions, parts, &len);
-	else
-		image = generate_factory_image(cpe510_vendor, sizeof(cpe510_vendor)-1, parts, &len);
+	struct fwimage image;
+	uint8_t header[0x14], ptable[0x800];
 
-	FILE *file = fopen(output, "wb");
-	if (!file)
-		error(1, errno, "unable to open output file");
+	fwimage_init(&image);
 
-	if (fwrite(image, len, 1, file) != 1)
-		error(1, 0, "unable to write output file");
+	if (sysupgrade)
+		generate_sysupgrade_image(&image, cpe510_partitions, parts);
+	else
+		generate_factory_image(&image, header, ptable, cpe510_vendor, sizeof(cpe510_vendor)-1, parts);
 
-	fclose(file);
+	if (fwimage_write(&image, output))
+		error(1, errno, "unable to write output file");
 
-	free(image);
+	fwimage_free(&image);
 
 	size_t i;
 	for (i = 0; parts[i].name; i++)
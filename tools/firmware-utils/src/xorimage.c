@@ -27,15 +27,78 @@
 
 static char default_pattern[] = "12345678";
 
+#define BUF_SIZE	(1024 * 1024)
+#define XOR_BLOCK	4096
+
+/*
+ * The pattern repeated to a multiple of its length of at least XOR_BLOCK
+ * bytes, plus one more copy so that a block can start at any offset
+ */
+static const uint8_t *xor_pattern;
+static uint8_t *xor_buf;
+static size_t xor_buf_len;
+
+static int expand_pattern(const uint8_t *pattern, int p_len)
+{
+	size_t i;
+
+	if (xor_pattern == pattern)
+		return 0;
+
+	free(xor_buf);
+	xor_buf_len = (XOR_BLOCK / p_len + 1) * p_len;
+	xor_buf = malloc(xor_buf_len + p_len);
+	if (!xor_buf)
+		return -1;
+
+	for (i = 0; i < xor_buf_len + p_len; i++)
+		xor_buf[i] = pattern[i % p_len];
+
+	xor_pattern = pattern;
+	return 0;
+}
+
+static void xor_block(uint8_t *data, const uint8_t *pattern, size_t len)
+{
+	unsigned long d, p;
+
+	while (len >= sizeof(d)) {
+		memcpy(&d, data, sizeof(d));
+		memcpy(&p, pattern, sizeof(p));
+		d ^= p;
+		memcpy(data, &d, sizeof(d));
+
+		data += sizeof(d);
+		pattern += sizeof(d);
+		len -= sizeof(d);
+	}
+
+	while (len--)
+		*data++ ^= *pattern++;
+}
 
 int xor_data(uint8_t *data, size_t len, const uint8_t *pattern, int p_len, int p_off)
 {
 	int offset = p_off;
-	while (len--) {
-		*data ^= pattern[offset];
-		data++;
-		offset = (offset + 1) % p_len;
+
+	if (expand_pattern(pattern, p_len)) {
+		while (len--) {
+			*data ^= pattern[offset];
+			data++;
+			offset = (offset + 1) % p_len;
+		}
+		return offset;
 	}
+
+	while (len) {
+		size_t n = len < xor_buf_len ? len : xor_buf_len;
+
+		xor_block(data, xor_buf + offset, n);
+		data += n;
+		len -= n;
+		offset = (offset + n) % p_len;
+	}
+
 	return offset;
 }
 
@@ -51,7 +114,7 @@ void usage(void)
 
 int main(int argc, char **argv)
 {
-	char buf[1024];	/* keep this at 1k or adjust garbage calc below */
+	char *buf;
 	FILE *in = stdin;
 	FILE *out = stdout;
 	char *ifn = NULL;
@@ -102,8 +165,14 @@ int main(int argc, char **argv)
 	}
 
 
-	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
-		if (n < sizeof(buf)) {
+	buf = malloc(BUF_SIZE);
+	if (!buf) {
+		fprintf(stderr, "no memory for buffer\n");
+		return EXIT_FAILURE;
+	}
+
+	while ((n = fread(buf, 1, BUF_SIZE, in)) > 0) {
+		if (n < BUF_SIZE) {
 			if (ferror(in)) {
 			FREAD_ERROR:
 				fprintf(stderr, "fread error\n");